@@ -0,0 +1,350 @@
+// ===========================================================================
+//
+// Cross-replication aggregation of tcpchain cwnd traces.
+//
+// Reads N sixth.cwnd traces ("time old new" per change, time in seconds or,
+// with --cwndTimeNs, nanoseconds) and writes, for each bin of a common time
+// grid, the mean and the 5th, 50th and 95th percentiles of the congestion
+// window across the replications.  A trace contributes the window in force
+// at the end of each bin, holding its last value to --end; bins before its
+// first record are left out of its count.
+//
+//   tcpchain-aggregate --bin=0.1 --end=20 --jobs=8 run-*/sixth.cwnd
+//       > cwnd-bands.dat
+//   tcpchain-aggregate --timeScale=1e-9 --list=traces.txt --output=bands.dat
+//
+// The traces are streamed by --jobs threads, one file at a time each.  Per
+// bin the quantiles come from a relative-error sketch (DDSketch, log-spaced
+// buckets within --accuracy), so memory grows with the number of bins and
+// the spread of the values, not with the number or length of the traces.
+//
+//   plot "cwnd-bands.dat" using 1:3:5 with filledcurves, "" using 1:4 with lines
+// ===========================================================================
+//
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+struct Options
+{
+  std::vector<std::string> files;
+  double                   bin = 0.1;        //!< seconds
+  double                   start = 0;        //!< seconds
+  double                   end = 20;         //!< seconds; tcpchain's default simTime
+  double                   timeScale = 1;    //!< seconds per trace time unit
+  uint32_t                 column = 3;       //!< 1-based column of the window
+  double                   accuracy = 0.01;  //!< relative error of the quantiles
+  uint32_t                 jobs = 0;         //!< 0: one per online CPU
+  std::string              output;           //!< empty: standard output
+};
+
+/**
+ * Quantile sketch with relative error: value v > 0 is counted in bucket
+ * ceil (log_gamma (v)), gamma = (1 + a) / (1 - a), and a bucket is read
+ * back as the point within a of every value in it.  Buckets are kept
+ * sparse, so a sketch holds one entry per occupied factor-of-gamma range.
+ */
+class QuantileSketch
+{
+public:
+  explicit QuantileSketch (double accuracy);
+
+  void Add (double value);
+  uint64_t GetCount (void) const;
+  double GetMean (void) const;
+  /**
+   * \param q Quantile in [0, 1].
+   * \return The nearest-rank value at that quantile, within the sketch's
+   *         accuracy.
+   */
+  double GetQuantile (double q) const;
+
+private:
+  double                      m_gamma;
+  double                      m_logGamma;
+  std::map<int32_t, uint64_t> m_buckets;
+  uint64_t                    m_zeros;  //!< values <= 0
+  uint64_t                    m_count;
+  double                      m_sum;
+};
+
+QuantileSketch::QuantileSketch (double accuracy)
+  : m_gamma ((1 + accuracy) / (1 - accuracy)),
+    m_logGamma (std::log (m_gamma)),
+    m_zeros (0),
+    m_count (0),
+    m_sum (0)
+{
+}
+
+void
+QuantileSketch::Add (double value)
+{
+  ++m_count;
+  m_sum += value;
+  if (value <= 0)
+    {
+      ++m_zeros;
+      return;
+    }
+  ++m_buckets[static_cast<int32_t> (std::ceil (std::log (value) / m_logGamma))];
+}
+
+uint64_t
+QuantileSketch::GetCount (void) const
+{
+  return m_count;
+}
+
+double
+QuantileSketch::GetMean (void) const
+{
+  return m_count ? m_sum / m_count : std::numeric_limits<double>::quiet_NaN ();
+}
+
+double
+QuantileSketch::GetQuantile (double q) const
+{
+  if (m_count == 0)
+    {
+      return std::numeric_limits<double>::quiet_NaN ();
+    }
+  // Nearest rank: the smallest value with at least q * count values at or
+  // below it.  The slack keeps a product such as 0.05 * 20 from rounding up.
+  double nearest = std::ceil (q * m_count - 1e-9) - 1;
+  uint64_t rank = static_cast<uint64_t> (std::min (std::max (nearest, 0.0), static_cast<double> (m_count - 1)));
+  if (rank < m_zeros)
+    {
+      return 0;
+    }
+  uint64_t seen = m_zeros;
+  for (const auto &bucket : m_buckets)
+    {
+      seen += bucket.second;
+      if (seen > rank)
+        {
+          return 2 * std::pow (m_gamma, bucket.first) / (m_gamma + 1);
+        }
+    }
+  return 2 * std::pow (m_gamma, m_buckets.rbegin ()->first) / (m_gamma + 1);
+}
+
+/** Per-bin sketches shared by the reader threads. */
+struct Aggregate
+{
+  std::vector<QuantileSketch> bins;
+  std::mutex                  lock;
+  uint32_t                    traces = 0;
+  uint32_t                    failed = 0;
+};
+
+/**
+ * Parse field column (1-based) of a whitespace-separated line.
+ * \return Whether both the time (field 1) and the field were numbers.
+ */
+static bool
+ParseRecord (const char *line, uint32_t column, double &time, double &value)
+{
+  char *next;
+  time = std::strtod (line, &next);
+  if (next == line)
+    {
+      return false;
+    }
+  const char *p = next;
+  for (uint32_t field = 2; field <= column; ++field)
+    {
+      value = std::strtod (p, &next);
+      if (next == p)
+        {
+          return false;
+        }
+      p = next;
+    }
+  return true;
+}
+
+/**
+ * Stream one trace into per-bin values, then merge them into the shared
+ * sketches under one lock.
+ * \return Whether the file could be read.
+ */
+static bool
+AddTrace (const Options &opt, const std::string &path, Aggregate &aggregate)
+{
+  std::FILE *file = std::fopen (path.c_str (), "r");
+  if (!file)
+    {
+      std::cerr << path << ": " << std::strerror (errno) << std::endl;
+      return false;
+    }
+  std::size_t nBins = aggregate.bins.size ();
+  std::vector<double> values (nBins, std::numeric_limits<double>::quiet_NaN ());
+  std::size_t bin = 0;
+  double current = std::numeric_limits<double>::quiet_NaN ();
+  char line[256];
+  while (bin < nBins && std::fgets (line, sizeof (line), file))
+    {
+      double time = 0;
+      double value = 0;
+      if (!ParseRecord (line, opt.column, time, value))
+        {
+          continue;
+        }
+      time *= opt.timeScale;
+      // Bins that ended before this change keep the window in force until now.
+      while (bin < nBins && opt.start + (bin + 1) * opt.bin < time)
+        {
+          values[bin++] = current;
+        }
+      current = value;
+    }
+  for (; bin < nBins; ++bin)
+    {
+      values[bin] = current;
+    }
+  std::fclose (file);
+
+  std::lock_guard<std::mutex> guard (aggregate.lock);
+  for (std::size_t b = 0; b < nBins; ++b)
+    {
+      if (!std::isnan (values[b]))
+        {
+          aggregate.bins[b].Add (values[b]);
+        }
+    }
+  ++aggregate.traces;
+  return true;
+}
+
+static void
+Worker (const Options &opt, std::atomic<std::size_t> &next, Aggregate &aggregate)
+{
+  for (std::size_t i = next++; i < opt.files.size (); i = next++)
+    {
+      if (!AddTrace (opt, opt.files[i], aggregate))
+        {
+          std::lock_guard<std::mutex> guard (aggregate.lock);
+          ++aggregate.failed;
+        }
+    }
+}
+
+static bool
+ParseOption (const std::string &arg, const std::string &name, std::string &value)
+{
+  std::string prefix = "--" + name + "=";
+  if (arg.compare (0, prefix.size (), prefix) != 0)
+    {
+      return false;
+    }
+  value = arg.substr (prefix.size ());
+  return true;
+}
+
+int
+main (int argc, char *argv[])
+{
+  Options opt;
+  for (int i = 1; i < argc; ++i)
+    {
+      std::string arg = argv[i];
+      std::string v;
+      if (ParseOption (arg, "bin", v)) opt.bin = std::stod (v);
+      else if (ParseOption (arg, "start", v)) opt.start = std::stod (v);
+      else if (ParseOption (arg, "end", v)) opt.end = std::stod (v);
+      else if (ParseOption (arg, "timeScale", v)) opt.timeScale = std::stod (v);
+      else if (ParseOption (arg, "column", v)) opt.column = std::stoul (v);
+      else if (ParseOption (arg, "accuracy", v)) opt.accuracy = std::stod (v);
+      else if (ParseOption (arg, "jobs", v)) opt.jobs = std::stoul (v);
+      else if (ParseOption (arg, "output", v)) opt.output = v;
+      else if (ParseOption (arg, "list", v))
+        {
+          std::ifstream list (v);
+          if (!list)
+            {
+              std::cerr << v << ": " << std::strerror (errno) << std::endl;
+              return 1;
+            }
+          for (std::string path; std::getline (list, path); )
+            {
+              if (!path.empty ())
+                {
+                  opt.files.push_back (path);
+                }
+            }
+        }
+      else if (arg.compare (0, 2, "--") != 0) opt.files.push_back (arg);
+      else
+        {
+          std::cerr << "usage: " << argv[0] << " [--bin=SEC] [--start=SEC] [--end=SEC] [--timeScale=SEC]"
+                    << " [--column=N] [--accuracy=REL] [--jobs=N] [--output=PATH] [--list=PATH] TRACE..." << std::endl;
+          return 1;
+        }
+    }
+  if (opt.files.empty () || !(opt.bin > 0) || !(opt.end > opt.start) || opt.column < 2
+      || !(opt.accuracy > 0 && opt.accuracy < 1))
+    {
+      std::cerr << "need traces, --bin > 0, --end > --start, --column >= 2 and 0 < --accuracy < 1" << std::endl;
+      return 1;
+    }
+  if (opt.jobs == 0)
+    {
+      opt.jobs = std::max (1L, sysconf (_SC_NPROCESSORS_ONLN));
+    }
+
+  std::size_t nBins = static_cast<std::size_t> (std::ceil ((opt.end - opt.start) / opt.bin));
+  Aggregate aggregate;
+  aggregate.bins.assign (nBins, QuantileSketch (opt.accuracy));
+  std::atomic<std::size_t> next (0);
+  std::vector<std::thread> workers;
+  for (uint32_t j = 0; j < std::min<std::size_t> (opt.jobs, opt.files.size ()); ++j)
+    {
+      workers.emplace_back (Worker, std::cref (opt), std::ref (next), std::ref (aggregate));
+    }
+  for (std::thread &worker : workers)
+    {
+      worker.join ();
+    }
+
+  std::ofstream file;
+  if (!opt.output.empty ())
+    {
+      file.open (opt.output);
+      if (!file)
+        {
+          std::cerr << opt.output << ": " << std::strerror (errno) << std::endl;
+          return 1;
+        }
+    }
+  std::ostream &os = opt.output.empty () ? std::cout : file;
+  os << "# time\tmean\tp5\tp50\tp95\tn\n";
+  for (std::size_t b = 0; b < nBins; ++b)
+    {
+      const QuantileSketch &sketch = aggregate.bins[b];
+      os << opt.start + (b + 1) * opt.bin << "\t" << sketch.GetMean ()
+         << "\t" << sketch.GetQuantile (0.05) << "\t" << sketch.GetQuantile (0.5)
+         << "\t" << sketch.GetQuantile (0.95) << "\t" << sketch.GetCount () << "\n";
+    }
+  std::cerr << "aggregated " << aggregate.traces << " traces into " << nBins << " bins";
+  if (aggregate.failed)
+    {
+      std::cerr << ", " << aggregate.failed << " unreadable";
+    }
+  std::cerr << std::endl;
+  return aggregate.failed ? 1 : 0;
+}
@@ -0,0 +1,434 @@
+// ===========================================================================
+//
+// Analytics over binary tcpchain traces.
+//
+// Reads the 16-byte records written by tcpchain --cwndBinary (int64 time in
+// nanoseconds, uint32 old cwnd, uint32 new cwnd, host byte order) and
+// prints, per file, the record count, time span, min, max, mean and
+// standard deviation of the window and how often it crossed --threshold
+// upwards and downwards.  With --bin it also writes <file>.bins: count,
+// mean, min and max of the records in each time bin.
+//
+//   tcpchain-analyze --threshold=20000 --bin=0.1 --jobs=8 run-*/sixth.cwnd.bin
+//
+// Files are memory-mapped and spread over a pool of --jobs threads.  The
+// kernels gather eight records at a time with AVX2 when the CPU has it
+// (checked at run time, so the binary itself needs no -mavx2) and fall
+// back to scalar code otherwise or with --scalar; both give identical
+// results.  Throughput goes to standard error.
+// ===========================================================================
+//
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined (__x86_64__) || defined (__i386__)
+#include <immintrin.h>
+#define TCPCHAIN_HAVE_AVX2_KERNEL 1
+#endif
+
+struct Options
+{
+  std::vector<std::string> files;
+  uint32_t                 threshold = 0;      //!< 0: no crossing counts
+  double                   bin = 0;            //!< seconds; 0: no .bins output
+  bool                     oldColumn = false;  //!< analyze old cwnd instead of new
+  bool                     scalar = false;
+  uint32_t                 jobs = 0;           //!< 0: one per online CPU
+};
+
+/** One record of a --cwndBinary trace. */
+struct Record
+{
+  int64_t  timeNs;
+  uint32_t oldCwnd;
+  uint32_t newCwnd;
+};
+static_assert (sizeof (Record) == 16, "Record must match the trace layout");
+
+/** Running statistics of one value column. */
+struct Summary
+{
+  uint64_t count = 0;
+  uint32_t min = UINT32_MAX;
+  uint32_t max = 0;
+  uint64_t sum = 0;
+  double   sumSquares = 0;
+  uint64_t up = 0;      //!< threshold crossings from below
+  uint64_t down = 0;    //!< threshold crossings to below
+  bool     below = false;  //!< last value was below the threshold
+};
+
+/**
+ * Add records [0, n) to s, reading the 32-bit word at index word of each
+ * record (2: old cwnd, 3: new cwnd).
+ */
+static void
+SummarizeScalar (const Record *records, std::size_t n, uint32_t word, uint32_t threshold, Summary &s)
+{
+  const uint32_t *base = reinterpret_cast<const uint32_t *> (records) + word;
+  for (std::size_t i = 0; i < n; ++i)
+    {
+      uint32_t v = base[4 * i];
+      s.min = std::min (s.min, v);
+      s.max = std::max (s.max, v);
+      s.sum += v;
+      s.sumSquares += static_cast<double> (v) * v;
+      bool below = v < threshold;
+      if (s.count++ > 0)
+        {
+          s.up += s.below && !below;
+          s.down += !s.below && below;
+        }
+      s.below = below;
+    }
+}
+
+#ifdef TCPCHAIN_HAVE_AVX2_KERNEL
+/** SummarizeScalar, eight records per step. */
+__attribute__ ((target ("avx2"))) static void
+SummarizeAvx2 (const Record *records, std::size_t n, uint32_t word, uint32_t threshold, Summary &s)
+{
+  std::size_t blocks = n / 8;
+  if (blocks == 0)
+    {
+      SummarizeScalar (records, n, word, threshold, s);
+      return;
+    }
+  if (s.count == 0)
+    {
+      // No crossing into the first value.
+      s.below = reinterpret_cast<const uint32_t *> (records)[word] < threshold;
+    }
+  const int *base = reinterpret_cast<const int *> (records) + word;
+  const __m256i index = _mm256_setr_epi32 (0, 4, 8, 12, 16, 20, 24, 28);
+  // Unsigned order through signed compares and conversions: flip the sign bit.
+  const __m256i bias = _mm256_set1_epi32 (INT32_MIN);
+  const __m256i limit = _mm256_set1_epi32 (static_cast<int32_t> (threshold ^ 0x80000000u));
+  const __m256d offset = _mm256_set1_pd (2147483648.0);
+  __m256i minV = _mm256_set1_epi32 (-1);
+  __m256i maxV = _mm256_setzero_si256 ();
+  __m256i sumLo = _mm256_setzero_si256 ();
+  __m256i sumHi = _mm256_setzero_si256 ();
+  __m256d squares = _mm256_setzero_pd ();
+  uint32_t previous = s.below;
+  uint64_t up = 0;
+  uint64_t down = 0;
+  for (std::size_t b = 0; b < blocks; ++b)
+    {
+      __m256i v = _mm256_i32gather_epi32 (base + 32 * b, index, 4);
+      minV = _mm256_min_epu32 (minV, v);
+      maxV = _mm256_max_epu32 (maxV, v);
+      sumLo = _mm256_add_epi64 (sumLo, _mm256_cvtepu32_epi64 (_mm256_castsi256_si128 (v)));
+      sumHi = _mm256_add_epi64 (sumHi, _mm256_cvtepu32_epi64 (_mm256_extracti128_si256 (v, 1)));
+      __m256i flipped = _mm256_xor_si256 (v, bias);
+      __m256d lo = _mm256_add_pd (_mm256_cvtepi32_pd (_mm256_castsi256_si128 (flipped)), offset);
+      __m256d hi = _mm256_add_pd (_mm256_cvtepi32_pd (_mm256_extracti128_si256 (flipped, 1)), offset);
+      squares = _mm256_add_pd (squares, _mm256_add_pd (_mm256_mul_pd (lo, lo), _mm256_mul_pd (hi, hi)));
+      uint32_t below = _mm256_movemask_ps (_mm256_castsi256_ps (_mm256_cmpgt_epi32 (limit, flipped)));
+      // Bit i of before: whether the value preceding lane i was below.
+      uint32_t before = ((below << 1) | previous) & 0xff;
+      up += __builtin_popcount (before & ~below & 0xff);
+      down += __builtin_popcount (~before & below & 0xff);
+      previous = below >> 7;
+    }
+
+  alignas (32) uint32_t lanes[8];
+  _mm256_store_si256 (reinterpret_cast<__m256i *> (lanes), minV);
+  s.min = std::min (s.min, *std::min_element (lanes, lanes + 8));
+  _mm256_store_si256 (reinterpret_cast<__m256i *> (lanes), maxV);
+  s.max = std::max (s.max, *std::max_element (lanes, lanes + 8));
+  alignas (32) uint64_t sums[4];
+  _mm256_store_si256 (reinterpret_cast<__m256i *> (sums), _mm256_add_epi64 (sumLo, sumHi));
+  s.sum += sums[0] + sums[1] + sums[2] + sums[3];
+  alignas (32) double partial[4];
+  _mm256_store_pd (partial, squares);
+  s.sumSquares += partial[0] + partial[1] + partial[2] + partial[3];
+  s.up += up;
+  s.down += down;
+  s.count += blocks * 8;
+  s.below = previous;
+  SummarizeScalar (records + blocks * 8, n - blocks * 8, word, threshold, s);
+}
+#endif
+
+typedef void (*Kernel) (const Record *, std::size_t, uint32_t, uint32_t, Summary &);
+
+struct Result
+{
+  bool        ok = false;
+  std::size_t records = 0;
+  int64_t     firstNs = 0;
+  int64_t     lastNs = 0;
+  Summary     summary;
+};
+
+/** A read-only mapping of a whole file; empty files map to nothing. */
+class MappedFile
+{
+public:
+  explicit MappedFile (const std::string &path);
+  ~MappedFile ();
+
+  bool IsOpen (void) const;
+  const Record *GetRecords (void) const;
+  std::size_t GetCount (void) const;
+
+private:
+  int         m_fd;
+  void       *m_data;
+  std::size_t m_size;
+};
+
+MappedFile::MappedFile (const std::string &path)
+  : m_fd (open (path.c_str (), O_RDONLY)),
+    m_data (0),
+    m_size (0)
+{
+  struct stat info;
+  if (m_fd < 0 || fstat (m_fd, &info) < 0)
+    {
+      std::cerr << path << ": " << std::strerror (errno) << std::endl;
+      return;
+    }
+  m_size = info.st_size;
+  if (m_size % sizeof (Record) != 0)
+    {
+      std::cerr << path << ": size is not a multiple of " << sizeof (Record) << " bytes; ignoring the tail" << std::endl;
+    }
+  if (m_size > 0)
+    {
+      m_data = mmap (0, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+      if (m_data == MAP_FAILED)
+        {
+          std::cerr << path << ": " << std::strerror (errno) << std::endl;
+          m_data = 0;
+          return;
+        }
+      madvise (m_data, m_size, MADV_SEQUENTIAL);
+    }
+}
+
+MappedFile::~MappedFile ()
+{
+  if (m_data)
+    {
+      munmap (m_data, m_size);
+    }
+  if (m_fd >= 0)
+    {
+      close (m_fd);
+    }
+}
+
+bool
+MappedFile::IsOpen (void) const
+{
+  return m_fd >= 0 && (m_data || m_size == 0);
+}
+
+const Record *
+MappedFile::GetRecords (void) const
+{
+  return static_cast<const Record *> (m_data);
+}
+
+std::size_t
+MappedFile::GetCount (void) const
+{
+  return m_size / sizeof (Record);
+}
+
+static bool
+RecordBefore (const Record &record, int64_t timeNs)
+{
+  return record.timeNs < timeNs;
+}
+
+/** Write count, mean, min and max per bin of the (time-ordered) records. */
+static void
+WriteBins (const Options &opt, Kernel kernel, const std::string &path, const Record *records, std::size_t n)
+{
+  std::ofstream os (path + ".bins");
+  if (!os)
+    {
+      std::cerr << path << ".bins: " << std::strerror (errno) << std::endl;
+      return;
+    }
+  os << "# time\tcount\tmean\tmin\tmax\n";
+  if (n == 0)
+    {
+      return;
+    }
+  uint32_t word = opt.oldColumn ? 2 : 3;
+  int64_t binNs = std::max<int64_t> (std::llround (opt.bin * 1e9), 1);
+  const Record *end = records + n;
+  const Record *from = records;
+  for (int64_t start = records[0].timeNs / binNs * binNs; from < end; start += binNs)
+    {
+      const Record *to = std::lower_bound (from, end, start + binNs, RecordBefore);
+      Summary s;
+      kernel (from, to - from, word, 0, s);
+      os << start / 1e9 << "\t" << s.count;
+      if (s.count)
+        {
+          os << "\t" << static_cast<double> (s.sum) / s.count << "\t" << s.min << "\t" << s.max;
+        }
+      else
+        {
+          os << "\t-\t-\t-";
+        }
+      os << "\n";
+      from = to;
+    }
+}
+
+static Result
+Analyze (const Options &opt, Kernel kernel, const std::string &path)
+{
+  Result result;
+  MappedFile file (path);
+  if (!file.IsOpen ())
+    {
+      return result;
+    }
+  const Record *records = file.GetRecords ();
+  std::size_t n = file.GetCount ();
+  result.ok = true;
+  result.records = n;
+  if (n > 0)
+    {
+      result.firstNs = records[0].timeNs;
+      result.lastNs = records[n - 1].timeNs;
+      kernel (records, n, opt.oldColumn ? 2 : 3, opt.threshold, result.summary);
+    }
+  if (opt.bin > 0)
+    {
+      WriteBins (opt, kernel, path, records, n);
+    }
+  return result;
+}
+
+static void
+Worker (const Options &opt, Kernel kernel, std::atomic<std::size_t> &next, std::vector<Result> &results)
+{
+  for (std::size_t i = next++; i < opt.files.size (); i = next++)
+    {
+      results[i] = Analyze (opt, kernel, opt.files[i]);
+    }
+}
+
+static bool
+ParseOption (const std::string &arg, const std::string &name, std::string &value)
+{
+  std::string prefix = "--" + name + "=";
+  if (arg.compare (0, prefix.size (), prefix) != 0)
+    {
+      return false;
+    }
+  value = arg.substr (prefix.size ());
+  return true;
+}
+
+int
+main (int argc, char *argv[])
+{
+  Options opt;
+  for (int i = 1; i < argc; ++i)
+    {
+      std::string arg = argv[i];
+      std::string v;
+      if (ParseOption (arg, "threshold", v)) opt.threshold = std::stoul (v);
+      else if (ParseOption (arg, "bin", v)) opt.bin = std::stod (v);
+      else if (ParseOption (arg, "column", v) && (v == "old" || v == "new")) opt.oldColumn = v == "old";
+      else if (ParseOption (arg, "jobs", v)) opt.jobs = std::stoul (v);
+      else if (arg == "--scalar") opt.scalar = true;
+      else if (arg.compare (0, 2, "--") != 0) opt.files.push_back (arg);
+      else
+        {
+          std::cerr << "usage: " << argv[0] << " [--threshold=CWND] [--bin=SEC] [--column=old|new]"
+                    << " [--jobs=N] [--scalar] TRACE..." << std::endl;
+          return 1;
+        }
+    }
+  if (opt.files.empty ())
+    {
+      std::cerr << "no trace files given" << std::endl;
+      return 1;
+    }
+  if (opt.jobs == 0)
+    {
+      opt.jobs = std::max (1L, sysconf (_SC_NPROCESSORS_ONLN));
+    }
+
+  Kernel kernel = &SummarizeScalar;
+  const char *kernelName = "scalar";
+#ifdef TCPCHAIN_HAVE_AVX2_KERNEL
+  if (!opt.scalar && __builtin_cpu_supports ("avx2"))
+    {
+      kernel = &SummarizeAvx2;
+      kernelName = "avx2";
+    }
+#endif
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+  std::vector<Result> results (opt.files.size ());
+  std::atomic<std::size_t> next (0);
+  std::vector<std::thread> pool;
+  for (uint32_t j = 0; j < std::min<std::size_t> (opt.jobs, opt.files.size ()); ++j)
+    {
+      pool.emplace_back (Worker, std::cref (opt), kernel, std::ref (next), std::ref (results));
+    }
+  for (std::thread &worker : pool)
+    {
+      worker.join ();
+    }
+  double wall = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+
+  int status = 0;
+  uint64_t total = 0;
+  std::cout << "# file\trecords\tstart\tend\tmin\tmax\tmean\tstddev\tup\tdown\n";
+  for (std::size_t i = 0; i < opt.files.size (); ++i)
+    {
+      const Result &r = results[i];
+      if (!r.ok)
+        {
+          status = 1;
+          continue;
+        }
+      total += r.records;
+      const Summary &s = r.summary;
+      std::cout << opt.files[i] << "\t" << r.records << "\t" << r.firstNs / 1e9 << "\t" << r.lastNs / 1e9;
+      if (s.count)
+        {
+          double mean = static_cast<double> (s.sum) / s.count;
+          double variance = std::max (s.sumSquares / s.count - mean * mean, 0.0);
+          std::cout << "\t" << s.min << "\t" << s.max << "\t" << mean << "\t" << std::sqrt (variance)
+                    << "\t" << s.up << "\t" << s.down;
+        }
+      else
+        {
+          std::cout << "\t-\t-\t-\t-\t0\t0";
+        }
+      std::cout << "\n";
+    }
+  std::cerr << "analyzed " << total << " records in " << opt.files.size () << " files with the "
+            << kernelName << " kernel on " << std::min<std::size_t> (opt.jobs, opt.files.size ())
+            << " threads: " << wall << "s, " << total / std::max (wall, 1e-9) / 1e6 << "M records/s" << std::endl;
+  return status;
+}
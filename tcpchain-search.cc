@@ -0,0 +1,716 @@
+// ===========================================================================
+//
+// Goal-seeking search over one tcpchain parameter.
+//
+// Bisection finds the operating limit of a monotone metric: the largest
+// loss rate, or the smallest buffer, at which the metric (by default the
+// bulk goodput) still reaches --target.  Golden-section search finds the
+// parameter value that maximizes the metric on a unimodal range.  A sweep
+// probes --points values, ordered and pruned by an analytic goodput model
+// (Padhye et al., which reduces to Mathis et al. without timeouts).  Every
+// probe runs --replications seeded copies of the scenario in parallel and
+// uses their mean; the search stops once the bracket is narrower than
+// --precision (relative to its upper end).
+//
+//   tcpchain-search --binary=build/scratch/tcpchain --param=errorRate
+//       --lo=1e-6 --hi=1e-1 --scale=log --target=3 --replications=8
+//   tcpchain-search --binary=build/scratch/tcpchain --param=queueSize
+//       --unit=p --integer --lo=1 --hi=1000 --target=4.5 -- --nFlows=4
+//   tcpchain-search --binary=build/scratch/tcpchain --mode=sweep --points=21
+//       --param=linkDelay --unit=ms --lo=1 --hi=100 --target=0.5 --band=0.5
+//
+// Arguments after "--" are passed to every run.  The binary is run with
+// --runStats=true --anim=false and the metric is read from a "name=value"
+// field of its output (goodputMbps is on the "run:" line).  For goodputMbps
+// every simulated probe also reports the model's prediction and its error.
+//
+// Each run works in a private temporary directory under $TMPDIR (or /tmp),
+// removed once it exits, so parallel replications do not overwrite each
+// other's sixth.* files.  Paths after "--" should therefore be absolute.
+// ===========================================================================
+//
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <ftw.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct Options
+{
+  std::string              binary;
+  std::string              param;
+  std::string              unit;
+  bool                     integer = false;
+  bool                     logScale = false;
+  std::string              mode = "bisect";
+  double                   lo = 0;
+  double                   hi = 0;
+  double                   target = 0;
+  std::string              metric = "goodputMbps";
+  double                   precision = 0.05;
+  uint32_t                 replications = 4;
+  uint32_t                 jobs = 0;  //!< 0: one per online CPU
+  uint32_t                 seed = 1;
+  double                   timeLimit = 600;  //!< seconds per probe
+  uint32_t                 maxProbes = 40;
+  uint32_t                 points = 11;   //!< sweep grid size
+  double                   band = 0.5;    //!< sweep: simulate points predicted within band * target of it
+  std::vector<std::string> extra;
+};
+
+/** Mean of the metric over the replications of one probe. */
+struct Probe
+{
+  double   value;
+  double   predicted;  //!< analytic goodput in Mbps; NaN without a model
+  double   mean;
+  double   stddev;
+  uint32_t ok;      //!< replications that reported the metric
+  uint32_t failed;
+};
+
+/** A child run in flight. */
+struct Child
+{
+  pid_t       pid;
+  int         fd;
+  std::string output;
+  bool        done;
+  std::string dir;   //!< private working directory of the run
+};
+
+static std::string
+FormatValue (const Options &opt, double value)
+{
+  std::ostringstream os;
+  if (opt.integer)
+    {
+      os << static_cast<int64_t> (std::llround (value));
+    }
+  else
+    {
+      os << value;
+    }
+  return os.str () + opt.unit;
+}
+
+static double
+Snap (const Options &opt, double value)
+{
+  return opt.integer ? std::round (value) : value;
+}
+
+static int
+RemoveEntry (const char *path, const struct stat *, int, struct FTW *)
+{
+  return remove (path);
+}
+
+/** Remove a run's working directory and everything the run left in it. */
+static void
+RemoveRunDir (const std::string &dir)
+{
+  if (!dir.empty () && nftw (dir.c_str (), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS) != 0)
+    {
+      std::perror (dir.c_str ());
+    }
+}
+
+/**
+ * Start one replication in a new temporary directory.
+ * \param fd Set to the read end of the run's standard output.
+ * \param dir Set to the directory, for RemoveRunDir once the run is reaped.
+ * \return The child's pid, or -1.
+ */
+static pid_t
+Spawn (const Options &opt, double value, uint32_t rngRun, int &fd, std::string &dir)
+{
+  const char *tmp = std::getenv ("TMPDIR");
+  std::string pattern = std::string (tmp && *tmp ? tmp : "/tmp") + "/tcpchain-search.XXXXXX";
+  if (!mkdtemp (&pattern[0]))
+    {
+      std::perror (pattern.c_str ());
+      return -1;
+    }
+  dir = pattern;
+  int out[2];
+  if (pipe (out) != 0)
+    {
+      std::perror ("pipe");
+      RemoveRunDir (dir);
+      return -1;
+    }
+  std::vector<std::string> args;
+  args.push_back ("--" + opt.param + "=" + FormatValue (opt, value));
+  args.push_back ("--RngRun=" + std::to_string (rngRun));
+  args.push_back ("--anim=false");
+  args.push_back ("--runStats=true");
+  args.insert (args.end (), opt.extra.begin (), opt.extra.end ());
+
+  pid_t pid = fork ();
+  if (pid < 0)
+    {
+      std::perror ("fork");
+      close (out[0]);
+      close (out[1]);
+      RemoveRunDir (dir);
+      return -1;
+    }
+  if (pid == 0)
+    {
+      if (chdir (dir.c_str ()) != 0)
+        {
+          _exit (127);
+        }
+      dup2 (out[1], STDOUT_FILENO);
+      int devnull = open ("/dev/null", O_WRONLY);
+      dup2 (devnull, STDERR_FILENO);
+      close (out[0]);
+      close (out[1]);
+      std::vector<char *> argv;
+      argv.push_back (const_cast<char *> (opt.binary.c_str ()));
+      for (std::string &arg : args)
+        {
+          argv.push_back (&arg[0]);
+        }
+      argv.push_back (0);
+      execv (opt.binary.c_str (), argv.data ());
+      _exit (127);
+    }
+  close (out[1]);
+  fd = out[0];
+  return pid;
+}
+
+/**
+ * \return The value of the last "name=value" field in \p output, or NaN.
+ */
+static double
+ParseMetric (const std::string &output, const std::string &name)
+{
+  std::string key = name + "=";
+  double value = NAN;
+  for (std::size_t pos = output.find (key); pos != std::string::npos; pos = output.find (key, pos + 1))
+    {
+      if (pos == 0 || std::isspace (static_cast<unsigned char> (output[pos - 1])))
+        {
+          value = std::strtod (output.c_str () + pos + key.size (), 0);
+        }
+    }
+  return value;
+}
+
+/** \return Bits per second of an ns-3 DataRate string such as "5Mbps". */
+static double
+ParseRate (const std::string &s)
+{
+  char *end = 0;
+  double v = std::strtod (s.c_str (), &end);
+  std::string unit (end);
+  if (unit == "bps" || unit == "b/s") return v;
+  if (unit == "kbps" || unit == "Kbps" || unit == "kb/s") return v * 1e3;
+  if (unit == "Mbps" || unit == "Mb/s") return v * 1e6;
+  if (unit == "Gbps" || unit == "Gb/s") return v * 1e9;
+  return NAN;
+}
+
+/** \return Seconds of an ns-3 Time string such as "2ms". */
+static double
+ParseTime (const std::string &s)
+{
+  char *end = 0;
+  double v = std::strtod (s.c_str (), &end);
+  std::string unit (end);
+  if (unit == "s" || unit.empty ()) return v;
+  if (unit == "ms") return v * 1e-3;
+  if (unit == "us") return v * 1e-6;
+  if (unit == "ns") return v * 1e-9;
+  return NAN;
+}
+
+/**
+ * Analytic bulk goodput of the chain in Mbps at \p value of the searched
+ * parameter, or NaN when the metric is not goodputMbps or the scenario is
+ * outside the model (non-bulk workloads, unparsable values).
+ *
+ * Per flow, the Padhye et al. steady-state throughput
+ *   B = min (Wmax / RTT, MSS / (RTT sqrt (2bp/3) + T0 min (1, 3 sqrt (3bp/8)) p (1 + 32p^2)))
+ * with b = 2 (delayed ACKs), T0 the 1 s minimum RTO and Wmax the receive
+ * buffer.  RTT is the propagation and serialization time of a segment and
+ * its ACK over every hop; p is the frame loss probability of the
+ * byte-unit RateErrorModel.  The flows share min (bottleneck, nFlows *
+ * appRate), scaled by the payload share of a frame.
+ */
+static double
+Predict (const Options &opt, double value)
+{
+  if (opt.metric != "goodputMbps")
+    {
+      return NAN;
+    }
+  // tcpchain and ns-3 defaults, overridden by the fixed arguments and the parameter.
+  std::vector<std::pair<std::string, std::string> > args = {
+    {"hops", "3"}, {"linkRate", "5Mbps"}, {"linkDelay", "2ms"}, {"errorRate", "0.00001"},
+    {"nFlows", "1"}, {"appRate", "1Mbps"}, {"workload", "bulk"}, {"paths", "1"},
+    {"edgeRate", ""}, {"bottleneckRate", ""}, {"ecnHop", "-1"},
+    {"ns3::TcpSocket::SegmentSize", "536"}, {"ns3::TcpSocket::RcvBufSize", "131072"}
+  };
+  std::vector<std::string> given = opt.extra;
+  given.push_back ("--" + opt.param + "=" + FormatValue (opt, value));
+  for (const std::string &arg : given)
+    {
+      for (std::pair<std::string, std::string> &kv : args)
+        {
+          std::string prefix = "--" + kv.first + "=";
+          if (arg.compare (0, prefix.size (), prefix) == 0)
+            {
+              kv.second = arg.substr (prefix.size ());
+            }
+        }
+    }
+  auto get = [&args] (const std::string &key) -> std::string
+    {
+      for (const std::pair<std::string, std::string> &kv : args)
+        {
+          if (kv.first == key)
+            {
+              return kv.second;
+            }
+        }
+      return "";
+    };
+  if (get ("workload") != "bulk")
+    {
+      return NAN;
+    }
+
+  double hops = std::stod (get ("hops"));
+  double paths = std::stod (get ("paths"));
+  double rate = ParseRate (get ("linkRate"));
+  double delay = ParseTime (get ("linkDelay"));
+  double errorRate = std::stod (get ("errorRate"));
+  double nFlows = std::stod (get ("nFlows"));
+  double appRate = ParseRate (get ("appRate"));
+  double mss = std::stod (get ("ns3::TcpSocket::SegmentSize"));
+  double wmax = std::stod (get ("ns3::TcpSocket::RcvBufSize"));
+  const double header = 20 + 20 + 2;  // IPv4, TCP, PPP
+  const double ackFrame = header;
+  double frame = mss + header;
+
+  // Bottleneck and per-direction path: one chain, or an edge, a path and an edge.
+  double bottleneck = rate * paths;
+  double linkCount = hops;
+  double serialization = hops * (frame + ackFrame) * 8 / rate;
+  if (paths > 1)
+    {
+      double edge = get ("edgeRate").empty () ? rate * paths : ParseRate (get ("edgeRate"));
+      bottleneck = std::min (bottleneck, edge);
+      linkCount += 2;
+      serialization += 2 * (frame + ackFrame) * 8 / edge;
+    }
+  if (std::stoi (get ("ecnHop")) >= 0 && !get ("bottleneckRate").empty ())
+    {
+      bottleneck = std::min (bottleneck, ParseRate (get ("bottleneckRate")));
+    }
+  if (std::isnan (rate) || std::isnan (delay) || std::isnan (appRate) || std::isnan (bottleneck))
+    {
+      return NAN;
+    }
+
+  double rtt = 2 * linkCount * delay + serialization;
+  double p = 1 - std::pow (1 - errorRate, frame);
+  double perFlow = wmax / rtt;
+  if (p > 0)
+    {
+      const double b = 2;
+      const double t0 = std::max (1.0, 2 * rtt);
+      double denom = rtt * std::sqrt (2 * b * p / 3)
+                     + t0 * std::min (1.0, 3 * std::sqrt (3 * b * p / 8)) * p * (1 + 32 * p * p);
+      perFlow = std::min (perFlow, mss / denom);
+    }
+  double goodput = std::min ({nFlows * perFlow * 8, bottleneck * mss / frame, nFlows * appRate});
+  return goodput / 1e6;
+}
+
+/**
+ * Run the replications of one probe, at most --jobs at a time, and average
+ * the metric over those that reported it.  Runs still going --timeLimit
+ * seconds after the probe started are killed and counted as failed.
+ */
+static Probe
+Evaluate (const Options &opt, double value)
+{
+  Probe probe = {value, Predict (opt, value), 0, 0, 0, 0};
+  std::vector<double> samples;
+  std::vector<Child> running;
+  uint32_t next = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+  while (next < opt.replications || !running.empty ())
+    {
+      while (next < opt.replications && running.size () < opt.jobs)
+        {
+          Child child = {-1, -1, "", false, ""};
+          child.pid = Spawn (opt, value, opt.seed + next, child.fd, child.dir);
+          ++next;
+          if (child.pid < 0)
+            {
+              ++probe.failed;
+              continue;
+            }
+          running.push_back (child);
+        }
+      if (running.empty ())
+        {
+          break;
+        }
+
+      double elapsed = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+      int waitMs = static_cast<int> ((opt.timeLimit - elapsed) * 1000);
+      std::vector<struct pollfd> fds;
+      for (const Child &child : running)
+        {
+          fds.push_back (pollfd {child.fd, POLLIN, 0});
+        }
+      int ready = waitMs > 0 ? poll (fds.data (), fds.size (), waitMs) : 0;
+      if (ready < 0 && errno == EINTR)
+        {
+          continue;
+        }
+      if (ready == 0)
+        {
+          // Out of time: every replication still running counts as failed.
+          for (Child &child : running)
+            {
+              kill (child.pid, SIGKILL);
+              child.output.clear ();
+              child.done = true;
+            }
+        }
+      char buf[4096];
+      for (std::size_t i = 0; i < running.size (); ++i)
+        {
+          if (fds[i].revents == 0)
+            {
+              continue;
+            }
+          ssize_t n = read (running[i].fd, buf, sizeof (buf));
+          if (n > 0)
+            {
+              running[i].output.append (buf, n);
+            }
+          else
+            {
+              running[i].done = true;
+            }
+        }
+      for (std::size_t i = 0; i < running.size (); )
+        {
+          Child &child = running[i];
+          if (!child.done)
+            {
+              ++i;
+              continue;
+            }
+          close (child.fd);
+          int status = 0;
+          waitpid (child.pid, &status, 0);
+          RemoveRunDir (child.dir);
+          double sample = ParseMetric (child.output, opt.metric);
+          if (WIFEXITED (status) && WEXITSTATUS (status) == 0 && !std::isnan (sample))
+            {
+              samples.push_back (sample);
+            }
+          else
+            {
+              ++probe.failed;
+            }
+          running.erase (running.begin () + i);
+        }
+    }
+
+  probe.ok = samples.size ();
+  for (double s : samples)
+    {
+      probe.mean += s / samples.size ();
+    }
+  for (double s : samples)
+    {
+      probe.stddev += (s - probe.mean) * (s - probe.mean);
+    }
+  probe.stddev = samples.size () > 1 ? std::sqrt (probe.stddev / (samples.size () - 1)) : 0;
+  std::cout << "probe " << opt.param << "=" << FormatValue (opt, value)
+            << " " << opt.metric << "=" << probe.mean << " sd=" << probe.stddev
+            << " runs=" << probe.ok << "/" << opt.replications;
+  if (!std::isnan (probe.predicted) && probe.ok > 0)
+    {
+      std::cout << " predicted=" << probe.predicted
+                << " error=" << 100 * (probe.predicted - probe.mean) / std::max (probe.mean, 1e-9) << "%";
+    }
+  std::cout << std::endl;
+  return probe;
+}
+
+/** \return The midpoint of [a, b] on the search scale. */
+static double
+Middle (const Options &opt, double a, double b)
+{
+  return Snap (opt, opt.logScale ? std::sqrt (a * b) : (a + b) / 2);
+}
+
+/** \return Whether the bracket [a, b] is within --precision. */
+static bool
+Converged (const Options &opt, double a, double b)
+{
+  double lo = std::min (a, b);
+  double hi = std::max (a, b);
+  if (opt.integer && hi - lo <= 1)
+    {
+      return true;
+    }
+  return hi - lo <= opt.precision * std::max (std::fabs (hi), 1e-300);
+}
+
+/** \return Probes a grid over the original range would need at the final bracket width. */
+static uint64_t
+GridPoints (const Options &opt, double a, double b)
+{
+  double width = std::max (std::fabs (b - a), opt.integer ? 1.0 : 1e-300);
+  if (opt.logScale)
+    {
+      return 1 + static_cast<uint64_t> (std::ceil (std::log (opt.hi / opt.lo) / std::log (std::max (a, b) / std::min (a, b))));
+    }
+  return 1 + static_cast<uint64_t> (std::ceil ((opt.hi - opt.lo) / width));
+}
+
+static int
+Bisect (const Options &opt)
+{
+  Probe lo = Evaluate (opt, Snap (opt, opt.lo));
+  Probe hi = Evaluate (opt, Snap (opt, opt.hi));
+  bool loPasses = lo.ok > 0 && lo.mean >= opt.target;
+  bool hiPasses = hi.ok > 0 && hi.mean >= opt.target;
+  if (loPasses == hiPasses)
+    {
+      std::cerr << opt.metric << " >= " << opt.target << (loPasses ? " holds at both ends" : " holds at neither end")
+                << " of [" << opt.lo << ", " << opt.hi << "]; the limit is not bracketed" << std::endl;
+      return 2;
+    }
+  // good meets the target, bad does not; the limit lies between them.
+  double good = loPasses ? lo.value : hi.value;
+  double bad = loPasses ? hi.value : lo.value;
+  uint32_t probes = 2;
+  while (!Converged (opt, good, bad) && probes < opt.maxProbes)
+    {
+      double mid = Middle (opt, good, bad);
+      if (mid == good || mid == bad)
+        {
+          break;
+        }
+      Probe p = Evaluate (opt, mid);
+      ++probes;
+      (p.ok > 0 && p.mean >= opt.target ? good : bad) = mid;
+    }
+  std::cout << "limit: " << opt.param << "=" << FormatValue (opt, good)
+            << " keeps " << opt.metric << " >= " << opt.target
+            << " (" << FormatValue (opt, bad) << " does not)"
+            << " probes=" << probes << " runs=" << probes * opt.replications
+            << " gridRuns=" << GridPoints (opt, good, bad) * opt.replications << std::endl;
+  return 0;
+}
+
+static int
+GoldenSection (const Options &opt)
+{
+  // Work in log space for --scale=log so the ratio, not the width, shrinks.
+  auto to = [&opt] (double v) { return opt.logScale ? std::log (v) : v; };
+  auto from = [&opt] (double x) { return Snap (opt, opt.logScale ? std::exp (x) : x); };
+  const double invPhi = (std::sqrt (5.0) - 1) / 2;
+
+  double a = to (opt.lo);
+  double b = to (opt.hi);
+  double c = b - invPhi * (b - a);
+  double d = a + invPhi * (b - a);
+  Probe pc = Evaluate (opt, from (c));
+  Probe pd = Evaluate (opt, from (d));
+  uint32_t probes = 2;
+  while (!Converged (opt, from (a), from (b)) && probes < opt.maxProbes)
+    {
+      if (pc.mean >= pd.mean)
+        {
+          b = d;
+          d = c;
+          pd = pc;
+          c = b - invPhi * (b - a);
+          pc = Evaluate (opt, from (c));
+        }
+      else
+        {
+          a = c;
+          c = d;
+          pc = pd;
+          d = a + invPhi * (b - a);
+          pd = Evaluate (opt, from (d));
+        }
+      ++probes;
+    }
+  const Probe &best = pc.mean >= pd.mean ? pc : pd;
+  std::cout << "best: " << opt.param << "=" << FormatValue (opt, best.value)
+            << " " << opt.metric << "=" << best.mean << " sd=" << best.stddev
+            << " bracket=[" << FormatValue (opt, from (a)) << ", " << FormatValue (opt, from (b)) << "]"
+            << " probes=" << probes << " runs=" << probes * opt.replications
+            << " gridRuns=" << GridPoints (opt, from (a), from (b)) * opt.replications << std::endl;
+  return 0;
+}
+
+/**
+ * Probe --points values evenly spread over [lo, hi] on the search scale.
+ * Points the model predicts within --band * target of the target are
+ * simulated nearest first; the rest are reported as predictions only.
+ * Without a model every point is simulated in order.
+ */
+static int
+Sweep (const Options &opt)
+{
+  std::vector<Probe> points;
+  for (uint32_t i = 0; i < opt.points; ++i)
+    {
+      double f = opt.points > 1 ? static_cast<double> (i) / (opt.points - 1) : 0;
+      double v = opt.logScale ? opt.lo * std::pow (opt.hi / opt.lo, f) : opt.lo + f * (opt.hi - opt.lo);
+      v = Snap (opt, v);
+      if (points.empty () || points.back ().value != v)
+        {
+          points.push_back (Probe {v, Predict (opt, v), 0, 0, 0, 0});
+        }
+    }
+  std::stable_sort (points.begin (), points.end (), [&opt] (const Probe &a, const Probe &b)
+    {
+      if (std::isnan (a.predicted) || std::isnan (b.predicted))
+        {
+          return false;
+        }
+      return std::fabs (a.predicted - opt.target) < std::fabs (b.predicted - opt.target);
+    });
+
+  uint32_t simulated = 0;
+  double absError = 0;
+  uint32_t compared = 0;
+  for (const Probe &point : points)
+    {
+      if (!std::isnan (point.predicted)
+          && std::fabs (point.predicted - opt.target) > opt.band * std::fabs (opt.target))
+        {
+          std::cout << "skip " << opt.param << "=" << FormatValue (opt, point.value)
+                    << " predicted=" << point.predicted << std::endl;
+          continue;
+        }
+      Probe p = Evaluate (opt, point.value);
+      ++simulated;
+      if (!std::isnan (p.predicted) && p.ok > 0)
+        {
+          absError += std::fabs (p.predicted - p.mean) / std::max (p.mean, 1e-9);
+          ++compared;
+        }
+    }
+  std::cout << "sweep: points=" << points.size () << " simulated=" << simulated
+            << " runs=" << simulated * opt.replications;
+  if (compared > 0)
+    {
+      std::cout << " meanAbsError=" << 100 * absError / compared << "%";
+    }
+  std::cout << std::endl;
+  return 0;
+}
+
+static bool
+ParseOption (const std::string &arg, const std::string &name, std::string &value)
+{
+  std::string prefix = "--" + name + "=";
+  if (arg.compare (0, prefix.size (), prefix) != 0)
+    {
+      return false;
+    }
+  value = arg.substr (prefix.size ());
+  return true;
+}
+
+int
+main (int argc, char *argv[])
+{
+  Options opt;
+  for (int i = 1; i < argc; ++i)
+    {
+      std::string arg = argv[i];
+      std::string v;
+      if (arg == "--")
+        {
+          opt.extra.assign (argv + i + 1, argv + argc);
+          break;
+        }
+      if (ParseOption (arg, "binary", v)) opt.binary = v;
+      else if (ParseOption (arg, "param", v)) opt.param = v;
+      else if (ParseOption (arg, "unit", v)) opt.unit = v;
+      else if (arg == "--integer") opt.integer = true;
+      else if (ParseOption (arg, "scale", v) && (v == "log" || v == "linear")) opt.logScale = v == "log";
+      else if (ParseOption (arg, "mode", v) && (v == "bisect" || v == "golden" || v == "sweep")) opt.mode = v;
+      else if (ParseOption (arg, "lo", v)) opt.lo = std::stod (v);
+      else if (ParseOption (arg, "hi", v)) opt.hi = std::stod (v);
+      else if (ParseOption (arg, "target", v)) opt.target = std::stod (v);
+      else if (ParseOption (arg, "metric", v)) opt.metric = v;
+      else if (ParseOption (arg, "precision", v)) opt.precision = std::stod (v);
+      else if (ParseOption (arg, "replications", v)) opt.replications = std::stoul (v);
+      else if (ParseOption (arg, "jobs", v)) opt.jobs = std::stoul (v);
+      else if (ParseOption (arg, "seed", v)) opt.seed = std::stoul (v);
+      else if (ParseOption (arg, "timeLimit", v)) opt.timeLimit = std::stod (v);
+      else if (ParseOption (arg, "maxProbes", v)) opt.maxProbes = std::stoul (v);
+      else if (ParseOption (arg, "points", v)) opt.points = std::stoul (v);
+      else if (ParseOption (arg, "band", v)) opt.band = std::stod (v);
+      else
+        {
+          std::cerr << "usage: " << argv[0] << " --binary=PATH --param=NAME --lo=X --hi=Y"
+                    << " [--target=T] [--mode=bisect|golden|sweep] [--points=N] [--band=REL] [--scale=linear|log] [--unit=SUFFIX] [--integer]"
+                    << " [--metric=NAME] [--precision=REL] [--replications=N] [--jobs=N] [--seed=N]"
+                    << " [--timeLimit=SEC] [--maxProbes=N] [-- tcpchain args]" << std::endl;
+          return 1;
+        }
+    }
+  if (opt.binary.empty () || opt.param.empty () || !(opt.lo < opt.hi) || opt.replications == 0)
+    {
+      std::cerr << "--binary, --param, --lo < --hi and --replications > 0 are required" << std::endl;
+      return 1;
+    }
+  // Runs start in their own directories, so resolve the binary from here.
+  char binary[PATH_MAX];
+  if (!realpath (opt.binary.c_str (), binary))
+    {
+      std::perror (opt.binary.c_str ());
+      return 1;
+    }
+  opt.binary = binary;
+  if (opt.logScale && opt.lo <= 0)
+    {
+      std::cerr << "--scale=log needs --lo > 0" << std::endl;
+      return 1;
+    }
+  if (opt.jobs == 0)
+    {
+      opt.jobs = std::max (1L, sysconf (_SC_NPROCESSORS_ONLN));
+    }
+  if (opt.mode == "sweep")
+    {
+      return Sweep (opt);
+    }
+  return opt.mode == "golden" ? GoldenSection (opt) : Bisect (opt);
+}
@@ -0,0 +1,475 @@
+// ===========================================================================
+//
+// Randomized stress harness for tcpchain.
+//
+// Generates random valid scenarios (hop count, link rate and delay, error
+// rate, flow count, queue size, duration), runs the tcpchain binary on each
+// one under a wall-time and address-space limit, and records events per
+// second and peak RSS.  The slowest cases are then shrunk one parameter at a
+// time while they stay slow, and written out as reproducer command lines.
+//
+//   tcpchain-stress --binary=build/scratch/tcpchain --runs=50 --timeLimit=60
+//
+// The binary is run with --runStats=true --anim=false, and the harness reads
+// the "run:" line that tcpchain prints after Simulator::Run ().  The tail of
+// each run's standard error goes into the report, so a failed run can be
+// told apart from one that ran out of memory.
+// ===========================================================================
+//
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct Scenario
+{
+  uint32_t hops;
+  double   linkRateMbps;
+  double   linkDelayMs;
+  double   errorRate;
+  uint32_t nFlows;
+  uint32_t queuePackets;
+  double   simTime;
+  uint32_t rngRun;
+};
+
+struct RunResult
+{
+  enum Status { OK, TIMEOUT, MEMORY, FAILED };
+
+  Status   status;
+  double   wall;        //!< seconds
+  uint64_t events;
+  double   eventsPerSec;
+  uint64_t peakRssKiB;
+  double   pressure;    //!< max (wall / time limit, RSS / memory limit); >= 1 means a limit was hit
+  std::string stderrTail;  //!< last line(s) of standard error, on one line
+};
+
+struct Options
+{
+  std::string binary;
+  uint32_t    runs = 50;
+  uint32_t    seed = 1;
+  double      timeLimit = 60;
+  uint64_t    memLimitMb = 2048;
+  uint32_t    keep = 5;
+  uint32_t    minimizeRuns = 20;
+  std::string report = "tcpchain-stress.tsv";
+  std::string repro = "tcpchain-stress-repro.txt";
+};
+
+/** Bytes of standard error kept per run. */
+static const std::size_t STDERR_TAIL_BYTES = 240;
+
+static const char *
+StatusName (RunResult::Status status)
+{
+  switch (status)
+    {
+    case RunResult::OK: return "ok";
+    case RunResult::TIMEOUT: return "timeout";
+    case RunResult::MEMORY: return "memory";
+    case RunResult::FAILED: return "failed";
+    }
+  return "?";
+}
+
+static bool
+operator== (const Scenario &a, const Scenario &b)
+{
+  return a.hops == b.hops && a.linkRateMbps == b.linkRateMbps && a.linkDelayMs == b.linkDelayMs
+         && a.errorRate == b.errorRate && a.nFlows == b.nFlows && a.queuePackets == b.queuePackets
+         && a.simTime == b.simTime && a.rngRun == b.rngRun;
+}
+
+static std::vector<std::string>
+ScenarioArgs (const Scenario &s)
+{
+  std::vector<std::string> args;
+  std::ostringstream a;
+  a << "--hops=" << s.hops;
+  args.push_back (a.str ());
+  a.str ("");
+  a << "--linkRate=" << s.linkRateMbps << "Mbps";
+  args.push_back (a.str ());
+  a.str ("");
+  a << "--linkDelay=" << s.linkDelayMs << "ms";
+  args.push_back (a.str ());
+  a.str ("");
+  a << "--errorRate=" << s.errorRate;
+  args.push_back (a.str ());
+  a.str ("");
+  a << "--nFlows=" << s.nFlows;
+  args.push_back (a.str ());
+  a.str ("");
+  a << "--queueSize=" << s.queuePackets << "p";
+  args.push_back (a.str ());
+  a.str ("");
+  a << "--simTime=" << s.simTime;
+  args.push_back (a.str ());
+  a.str ("");
+  a << "--RngRun=" << s.rngRun;
+  args.push_back (a.str ());
+  args.push_back ("--anim=false");
+  args.push_back ("--runStats=true");
+  return args;
+}
+
+static std::string
+CommandLineOf (const Options &opt, const Scenario &s)
+{
+  std::string line = opt.binary;
+  for (const std::string &arg : ScenarioArgs (s))
+    {
+      line += " " + arg;
+    }
+  return line;
+}
+
+static Scenario
+RandomScenario (std::mt19937 &rng)
+{
+  std::uniform_real_distribution<double> u (0, 1);
+  Scenario s;
+  s.hops = 1 + static_cast<uint32_t> (std::pow (64.0, u (rng)));
+  s.linkRateMbps = std::round (std::pow (10.0, 3 * u (rng)));
+  s.linkDelayMs = std::round (std::pow (10.0, 2 * u (rng) - 1) * 100) / 100;
+  s.errorRate = u (rng) < 0.25 ? 0 : std::pow (10.0, -7 + 5 * u (rng));
+  s.nFlows = 1 + static_cast<uint32_t> (std::pow (100.0, u (rng)));
+  s.queuePackets = 1 + static_cast<uint32_t> (std::pow (1000.0, u (rng)));
+  s.simTime = std::round (1 + 19 * u (rng));
+  s.rngRun = rng () % 1000 + 1;
+  return s;
+}
+
+/**
+ * \return The last STDERR_TAIL_BYTES of text, with tabs and line breaks
+ *         turned into spaces so that it fits in one TSV field.
+ */
+static std::string
+OneLineTail (const std::string &text)
+{
+  std::size_t end = text.find_last_not_of (" \t\r\n");
+  if (end == std::string::npos)
+    {
+      return "";
+    }
+  std::size_t begin = end + 1 > STDERR_TAIL_BYTES ? end + 1 - STDERR_TAIL_BYTES : 0;
+  std::string tail = text.substr (begin, end + 1 - begin);
+  std::replace_if (tail.begin (), tail.end (), [] (char c) { return c == '\t' || c == '\n' || c == '\r'; }, ' ');
+  return tail;
+}
+
+/**
+ * Run one scenario in a child process and wait for it, killing it at the
+ * wall-time limit.  The address-space limit is enforced with RLIMIT_AS, so
+ * an allocation beyond it fails inside the child with std::bad_alloc.  A run
+ * counts as out of memory only if its peak RSS came near the limit or its
+ * standard error names bad_alloc; any other crash, SIGABRT included (an
+ * NS_ASSERT or NS_FATAL_ERROR), is a failure.
+ */
+static RunResult
+RunScenario (const Options &opt, const Scenario &s)
+{
+  RunResult r = {RunResult::FAILED, 0, 0, 0, 0, 0, ""};
+  int out[2];
+  int err[2];
+  if (pipe (out) != 0)
+    {
+      std::perror ("pipe");
+      return r;
+    }
+  if (pipe (err) != 0)
+    {
+      std::perror ("pipe");
+      close (out[0]);
+      close (out[1]);
+      return r;
+    }
+
+  std::vector<std::string> args = ScenarioArgs (s);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+  pid_t pid = fork ();
+  if (pid < 0)
+    {
+      std::perror ("fork");
+      close (out[0]);
+      close (out[1]);
+      close (err[0]);
+      close (err[1]);
+      return r;
+    }
+  if (pid == 0)
+    {
+      struct rlimit limit;
+      limit.rlim_cur = limit.rlim_max = opt.memLimitMb << 20;
+      setrlimit (RLIMIT_AS, &limit);
+      dup2 (out[1], STDOUT_FILENO);
+      dup2 (err[1], STDERR_FILENO);
+      close (out[0]);
+      close (out[1]);
+      close (err[0]);
+      close (err[1]);
+      std::vector<char *> argv;
+      argv.push_back (const_cast<char *> (opt.binary.c_str ()));
+      for (std::string &arg : args)
+        {
+          argv.push_back (&arg[0]);
+        }
+      argv.push_back (0);
+      execv (opt.binary.c_str (), argv.data ());
+      _exit (127);
+    }
+  close (out[1]);
+  close (err[1]);
+
+  std::string output;
+  std::string errors;
+  bool timedOut = false;
+  char buf[4096];
+  struct pollfd pfd[2] = {{out[0], POLLIN, 0}, {err[0], POLLIN, 0}};
+  while (pfd[0].fd >= 0 || pfd[1].fd >= 0)
+    {
+      double elapsed = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+      int waitMs = static_cast<int> ((opt.timeLimit - elapsed) * 1000);
+      if (waitMs <= 0)
+        {
+          kill (pid, SIGKILL);
+          timedOut = true;
+          break;
+        }
+      int ready = poll (pfd, 2, waitMs);
+      if (ready <= 0)
+        {
+          continue;
+        }
+      for (int i = 0; i < 2; ++i)
+        {
+          if (pfd[i].fd < 0 || pfd[i].revents == 0)
+            {
+              continue;
+            }
+          ssize_t n = read (pfd[i].fd, buf, sizeof (buf));
+          if (n <= 0)
+            {
+              // A negative fd is skipped by poll.
+              pfd[i].fd = -1;
+              continue;
+            }
+          if (i == 0)
+            {
+              output.append (buf, n);
+            }
+          else
+            {
+              errors.append (buf, n);
+              // Only the tail is reported; keep enough to find bad_alloc in it.
+              if (errors.size () > 16 * STDERR_TAIL_BYTES)
+                {
+                  errors.erase (0, errors.size () - 4 * STDERR_TAIL_BYTES);
+                }
+            }
+        }
+    }
+  close (out[0]);
+  close (err[0]);
+  r.stderrTail = OneLineTail (errors);
+
+  int status = 0;
+  struct rusage usage;
+  wait4 (pid, &status, 0, &usage);
+  r.wall = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+  r.peakRssKiB = usage.ru_maxrss;
+
+  std::size_t line = output.find ("run: events=");
+  if (line != std::string::npos)
+    {
+      r.events = std::strtoull (output.c_str () + line + 12, 0, 10);
+      r.eventsPerSec = r.events / std::max (r.wall, 1e-9);
+    }
+
+  if (timedOut)
+    {
+      r.status = RunResult::TIMEOUT;
+    }
+  else if (WIFEXITED (status) && WEXITSTATUS (status) == 0 && line != std::string::npos)
+    {
+      r.status = RunResult::OK;
+    }
+  else if (r.peakRssKiB * 1024 >= (opt.memLimitMb << 20) * 9 / 10
+           || errors.find ("bad_alloc") != std::string::npos)
+    {
+      r.status = RunResult::MEMORY;
+    }
+  else
+    {
+      r.status = RunResult::FAILED;
+    }
+
+  r.pressure = std::max (r.wall / opt.timeLimit,
+                         static_cast<double> (r.peakRssKiB) / (opt.memLimitMb * 1024));
+  if (r.status == RunResult::TIMEOUT || r.status == RunResult::MEMORY)
+    {
+      r.pressure = std::max (r.pressure, 1.0);
+    }
+  return r;
+}
+
+static void
+WriteRow (std::ostream &os, const Scenario &s, const RunResult &r)
+{
+  os << s.hops << "\t" << s.linkRateMbps << "\t" << s.linkDelayMs << "\t" << s.errorRate
+     << "\t" << s.nFlows << "\t" << s.queuePackets << "\t" << s.simTime << "\t" << s.rngRun
+     << "\t" << StatusName (r.status) << "\t" << r.wall << "\t" << r.events
+     << "\t" << r.eventsPerSec << "\t" << r.peakRssKiB << "\t" << r.pressure
+     << "\t" << r.stderrTail << std::endl;
+}
+
+/**
+ * Shrink a slow scenario toward the defaults, one parameter at a time,
+ * keeping each step only while the run stays at least half as slow as the
+ * original (or keeps hitting the same limit).
+ */
+static Scenario
+Minimize (const Options &opt, Scenario s, RunResult original)
+{
+  uint32_t budget = opt.minimizeRuns;
+  bool changed = true;
+  while (changed && budget > 0)
+    {
+      changed = false;
+      for (uint32_t param = 0; param < 7 && budget > 0; ++param)
+        {
+          Scenario t = s;
+          switch (param)
+            {
+            case 0: t.hops = std::max<uint32_t> (1, s.hops / 2); break;
+            case 1: t.nFlows = std::max<uint32_t> (1, s.nFlows / 2); break;
+            case 2: t.simTime = std::max (1.0, std::floor (s.simTime / 2)); break;
+            case 3: t.errorRate = 0; break;
+            case 4: t.queuePackets = 100; break;
+            case 5: t.linkRateMbps = 5; break;
+            case 6: t.linkDelayMs = 2; break;
+            }
+          if (t == s)
+            {
+              continue;
+            }
+          --budget;
+          RunResult r = RunScenario (opt, t);
+          bool stillSlow = original.pressure >= 1
+            ? r.status == original.status
+            : r.pressure >= original.pressure / 2;
+          if (stillSlow)
+            {
+              s = t;
+              changed = true;
+            }
+        }
+    }
+  return s;
+}
+
+static bool
+ParseOption (const std::string &arg, const std::string &name, std::string &value)
+{
+  std::string prefix = "--" + name + "=";
+  if (arg.compare (0, prefix.size (), prefix) != 0)
+    {
+      return false;
+    }
+  value = arg.substr (prefix.size ());
+  return true;
+}
+
+int
+main (int argc, char *argv[])
+{
+  Options opt;
+  for (int i = 1; i < argc; ++i)
+    {
+      std::string arg = argv[i];
+      std::string v;
+      if (ParseOption (arg, "binary", v)) opt.binary = v;
+      else if (ParseOption (arg, "runs", v)) opt.runs = std::stoul (v);
+      else if (ParseOption (arg, "seed", v)) opt.seed = std::stoul (v);
+      else if (ParseOption (arg, "timeLimit", v)) opt.timeLimit = std::stod (v);
+      else if (ParseOption (arg, "memLimitMb", v)) opt.memLimitMb = std::stoull (v);
+      else if (ParseOption (arg, "keep", v)) opt.keep = std::stoul (v);
+      else if (ParseOption (arg, "minimizeRuns", v)) opt.minimizeRuns = std::stoul (v);
+      else if (ParseOption (arg, "report", v)) opt.report = v;
+      else if (ParseOption (arg, "repro", v)) opt.repro = v;
+      else
+        {
+          std::cerr << "usage: " << argv[0] << " --binary=PATH [--runs=N] [--seed=N] [--timeLimit=SEC]"
+                    << " [--memLimitMb=MB] [--keep=N] [--minimizeRuns=N] [--report=FILE] [--repro=FILE]"
+                    << std::endl;
+          return 1;
+        }
+    }
+  if (opt.binary.empty ())
+    {
+      std::cerr << "--binary is required" << std::endl;
+      return 1;
+    }
+
+  std::ofstream report (opt.report.c_str ());
+  report << "hops\tlinkRateMbps\tlinkDelayMs\terrorRate\tnFlows\tqueuePackets\tsimTime\trngRun"
+         << "\tstatus\twall\tevents\teventsPerSec\tpeakRssKiB\tpressure\tstderrTail" << std::endl;
+
+  std::mt19937 rng (opt.seed);
+  std::vector<std::pair<Scenario, RunResult> > runs;
+  for (uint32_t i = 0; i < opt.runs; ++i)
+    {
+      Scenario s = RandomScenario (rng);
+      RunResult r = RunScenario (opt, s);
+      WriteRow (report, s, r);
+      std::cout << "[" << i + 1 << "/" << opt.runs << "] " << StatusName (r.status)
+                << " wall=" << r.wall << "s events/s=" << r.eventsPerSec
+                << " peakRss=" << r.peakRssKiB / 1024 << "MiB" << std::endl;
+      if (r.status == RunResult::FAILED && !r.stderrTail.empty ())
+        {
+          std::cout << "  stderr: " << r.stderrTail << std::endl;
+        }
+      runs.push_back (std::make_pair (s, r));
+    }
+
+  std::sort (runs.begin (), runs.end (),
+             [] (const std::pair<Scenario, RunResult> &a, const std::pair<Scenario, RunResult> &b)
+             {
+               return a.second.pressure > b.second.pressure;
+             });
+
+  std::ofstream repro (opt.repro.c_str ());
+  for (uint32_t i = 0; i < std::min<std::size_t> (opt.keep, runs.size ()); ++i)
+    {
+      const Scenario &s = runs[i].first;
+      const RunResult &r = runs[i].second;
+      if (r.status == RunResult::FAILED)
+        {
+          repro << "# failed (not a slow path): " << CommandLineOf (opt, s) << std::endl
+                << "#   stderr: " << r.stderrTail << std::endl;
+          continue;
+        }
+      Scenario minimal = Minimize (opt, s, r);
+      repro << "# " << StatusName (r.status) << " wall=" << r.wall << "s peakRss=" << r.peakRssKiB
+            << "KiB pressure=" << r.pressure << std::endl
+            << "# original: " << CommandLineOf (opt, s) << std::endl
+            << CommandLineOf (opt, minimal) << std::endl;
+    }
+  std::cout << "report: " << opt.report << ", reproducers: " << opt.repro << std::endl;
+  return 0;
+}
@@ -8,11 +8,526 @@
 #include "ns3/point-to-point-module.h"
 #include "ns3/applications-module.h"
 #include "ns3/netanim-module.h"
+#include "ns3/traffic-control-module.h"
+#include "ns3/fd-net-device-module.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <csignal>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#ifdef __cpp_impl_coroutine
+#include <coroutine>
+#endif
 
 using namespace ns3;
 
 NS_LOG_COMPONENT_DEFINE ("SixthScriptExample");
 
+/**
+ * Discrete packet-size distribution sampled with Walker's alias method, so
+ * a draw costs one uniform variate and one table lookup whatever the number
+ * of sizes.
+ */
+class PacketSizeDistribution : public SimpleRefCount<PacketSizeDistribution>
+{
+public:
+  PacketSizeDistribution (const std::vector<uint32_t> &sizes, const std::vector<double> &weights);
+
+  /**
+   * Simple IMIX: 40, 576 and 1500 byte payloads in a 7:4:1 ratio.
+   * \return The distribution.
+   */
+  static Ptr<PacketSizeDistribution> Imix (void);
+  /**
+   * Load an empirical CDF.  Each non-comment line holds a size in bytes and
+   * the cumulative probability of sizes up to it, in increasing order.
+   * \param path The file to read.
+   * \return The distribution.
+   */
+  static Ptr<PacketSizeDistribution> FromCdfFile (std::string path);
+
+  uint32_t GetN (void) const;
+  uint32_t GetSize (uint32_t i) const;
+  double GetMeanSize (void) const;
+  /**
+   * \param u Uniform variate in [0, 1).
+   * \return Index of the drawn size.
+   */
+  uint32_t Draw (double u) const;
+
+private:
+  std::vector<uint32_t> m_sizes;
+  std::vector<double>   m_prob;   //!< alias-table acceptance probability
+  std::vector<uint32_t> m_alias;  //!< alias-table fallback index
+  double                m_mean;
+};
+
+PacketSizeDistribution::PacketSizeDistribution (const std::vector<uint32_t> &sizes, const std::vector<double> &weights)
+  : m_sizes (sizes),
+    m_prob (sizes.size ()),
+    m_alias (sizes.size ()),
+    m_mean (0)
+{
+  NS_ABORT_MSG_IF (sizes.empty () || sizes.size () != weights.size (), "Bad packet-size distribution");
+  double total = 0;
+  for (uint32_t i = 0; i < sizes.size (); ++i)
+    {
+      total += weights[i];
+      m_mean += weights[i] * sizes[i];
+    }
+  NS_ABORT_MSG_IF (total <= 0, "Packet-size weights must not all be zero");
+  m_mean /= total;
+
+  uint32_t n = sizes.size ();
+  std::vector<double> scaled (n);
+  std::vector<uint32_t> small, large;
+  for (uint32_t i = 0; i < n; ++i)
+    {
+      scaled[i] = weights[i] * n / total;
+      (scaled[i] < 1.0 ? small : large).push_back (i);
+    }
+  while (!small.empty () && !large.empty ())
+    {
+      uint32_t s = small.back ();
+      small.pop_back ();
+      uint32_t l = large.back ();
+      m_prob[s] = scaled[s];
+      m_alias[s] = l;
+      scaled[l] -= 1.0 - scaled[s];
+      if (scaled[l] < 1.0)
+        {
+          large.pop_back ();
+          small.push_back (l);
+        }
+    }
+  for (uint32_t i : small)
+    {
+      m_prob[i] = 1.0;
+      m_alias[i] = i;
+    }
+  for (uint32_t i : large)
+    {
+      m_prob[i] = 1.0;
+      m_alias[i] = i;
+    }
+}
+
+Ptr<PacketSizeDistribution>
+PacketSizeDistribution::Imix (void)
+{
+  return Create<PacketSizeDistribution> (std::vector<uint32_t> {40, 576, 1500},
+                                         std::vector<double> {7, 4, 1});
+}
+
+Ptr<PacketSizeDistribution>
+PacketSizeDistribution::FromCdfFile (std::string path)
+{
+  std::ifstream in (path.c_str ());
+  if (!in)
+    {
+      NS_FATAL_ERROR ("Cannot open packet-size CDF " << path);
+    }
+  std::vector<uint32_t> sizes;
+  std::vector<double> weights;
+  double last = 0;
+  std::string line;
+  while (std::getline (in, line))
+    {
+      std::istringstream fields (line);
+      uint32_t size;
+      double cdf;
+      if (line.empty () || line[0] == '#' || !(fields >> size >> cdf))
+        {
+          continue;
+        }
+      NS_ABORT_MSG_IF (cdf < last, "Packet-size CDF " << path << " is not monotone at size " << size);
+      sizes.push_back (size);
+      weights.push_back (cdf - last);
+      last = cdf;
+    }
+  NS_ABORT_MSG_IF (sizes.empty (), "Packet-size CDF " << path << " has no entries");
+  return Create<PacketSizeDistribution> (sizes, weights);
+}
+
+uint32_t
+PacketSizeDistribution::GetN (void) const
+{
+  return m_sizes.size ();
+}
+
+uint32_t
+PacketSizeDistribution::GetSize (uint32_t i) const
+{
+  return m_sizes[i];
+}
+
+double
+PacketSizeDistribution::GetMeanSize (void) const
+{
+  return m_mean;
+}
+
+uint32_t
+PacketSizeDistribution::Draw (double u) const
+{
+  double x = u * m_sizes.size ();
+  uint32_t i = std::min (static_cast<uint32_t> (x), GetN () - 1);
+  return (x - i < m_prob[i]) ? i : m_alias[i];
+}
+
+/**
+ * Streaming log-linear histogram of nanosecond latencies.  Each power of two
+ * is split into 32 sub-buckets, so a percentile is within about 3% of the
+ * exact value while the table stays a fixed 15 KiB whatever the sample count.
+ */
+class LatencyHistogram
+{
+public:
+  LatencyHistogram ();
+
+  void Record (Time t);
+  void Record (uint64_t ns);
+  void Merge (const LatencyHistogram &other);
+
+  uint64_t GetCount (void) const;
+  uint64_t GetMin (void) const;
+  uint64_t GetMax (void) const;
+  double GetMean (void) const;
+  /**
+   * \param p Percentile in [0, 100].
+   * \return Approximate latency in nanoseconds at that percentile.
+   */
+  uint64_t GetPercentile (double p) const;
+  /**
+   * Print count, mean, p50, p90, p99, p99.9 and max in milliseconds.
+   * \param os The output stream.
+   * \param label Prefix for the line.
+   */
+  void PrintSummary (std::ostream &os, std::string label) const;
+
+private:
+  static constexpr uint32_t SUB_BITS = 5;
+  static constexpr uint32_t SUB_BUCKETS = 1 << SUB_BITS;
+  static constexpr uint32_t N_BUCKETS = SUB_BUCKETS + (64 - SUB_BITS) * SUB_BUCKETS;
+
+  static uint32_t BucketOf (uint64_t ns);
+  static uint64_t BucketMid (uint32_t bucket);
+
+  std::vector<uint64_t> m_counts;
+  uint64_t              m_count;
+  uint64_t              m_min;
+  uint64_t              m_max;
+  double                m_sum;
+};
+
+LatencyHistogram::LatencyHistogram ()
+  : m_counts (N_BUCKETS, 0),
+    m_count (0),
+    m_min (UINT64_MAX),
+    m_max (0),
+    m_sum (0)
+{
+}
+
+uint32_t
+LatencyHistogram::BucketOf (uint64_t ns)
+{
+  if (ns < SUB_BUCKETS)
+    {
+      return ns;
+    }
+  uint32_t shift = 63 - __builtin_clzll (ns) - SUB_BITS;
+  return SUB_BUCKETS + shift * SUB_BUCKETS + ((ns >> shift) - SUB_BUCKETS);
+}
+
+uint64_t
+LatencyHistogram::BucketMid (uint32_t bucket)
+{
+  if (bucket < SUB_BUCKETS)
+    {
+      return bucket;
+    }
+  uint32_t shift = (bucket - SUB_BUCKETS) / SUB_BUCKETS;
+  uint64_t sub = (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+  return ((SUB_BUCKETS + sub) << shift) + ((uint64_t (1) << shift) >> 1);
+}
+
+void
+LatencyHistogram::Record (Time t)
+{
+  Record (static_cast<uint64_t> (std::max<int64_t> (t.GetNanoSeconds (), 0)));
+}
+
+void
+LatencyHistogram::Record (uint64_t ns)
+{
+  ++m_counts[BucketOf (ns)];
+  ++m_count;
+  m_min = std::min (m_min, ns);
+  m_max = std::max (m_max, ns);
+  m_sum += ns;
+}
+
+void
+LatencyHistogram::Merge (const LatencyHistogram &other)
+{
+  for (uint32_t i = 0; i < N_BUCKETS; ++i)
+    {
+      m_counts[i] += other.m_counts[i];
+    }
+  m_count += other.m_count;
+  m_min = std::min (m_min, other.m_min);
+  m_max = std::max (m_max, other.m_max);
+  m_sum += other.m_sum;
+}
+
+uint64_t
+LatencyHistogram::GetCount (void) const
+{
+  return m_count;
+}
+
+uint64_t
+LatencyHistogram::GetMin (void) const
+{
+  return m_count ? m_min : 0;
+}
+
+uint64_t
+LatencyHistogram::GetMax (void) const
+{
+  return m_max;
+}
+
+double
+LatencyHistogram::GetMean (void) const
+{
+  return m_count ? m_sum / m_count : 0;
+}
+
+uint64_t
+LatencyHistogram::GetPercentile (double p) const
+{
+  if (m_count == 0)
+    {
+      return 0;
+    }
+  uint64_t rank = std::max<uint64_t> (1, static_cast<uint64_t> (std::ceil (p / 100 * m_count)));
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < N_BUCKETS; ++i)
+    {
+      seen += m_counts[i];
+      if (seen >= rank)
+        {
+          return std::min (std::max (BucketMid (i), m_min), m_max);
+        }
+    }
+  return m_max;
+}
+
+void
+LatencyHistogram::PrintSummary (std::ostream &os, std::string label) const
+{
+  os << label << ": n=" << m_count
+     << " mean=" << GetMean () / 1e6
+     << "ms p50=" << GetPercentile (50) / 1e6
+     << "ms p90=" << GetPercentile (90) / 1e6
+     << "ms p99=" << GetPercentile (99) / 1e6
+     << "ms p99.9=" << GetPercentile (99.9) / 1e6
+     << "ms max=" << GetMax () / 1e6 << "ms" << std::endl;
+}
+
+/**
+ * Byte tag holding the time MyApp handed a payload to its socket.  Byte
+ * tags follow the bytes into whatever TCP segments carry them, including
+ * retransmissions.
+ */
+class SendTimeTag : public Tag
+{
+public:
+  /**
+   * Register this type.
+   * \return The TypeId.
+   */
+  static TypeId GetTypeId (void);
+  virtual TypeId GetInstanceTypeId (void) const;
+  virtual uint32_t GetSerializedSize (void) const;
+  virtual void Serialize (TagBuffer i) const;
+  virtual void Deserialize (TagBuffer i);
+  virtual void Print (std::ostream &os) const;
+
+  SendTimeTag ();
+  explicit SendTimeTag (Time sendTime);
+
+  Time GetSendTime (void) const;
+
+private:
+  int64_t m_sendNs;
+};
+
+/* static */
+TypeId SendTimeTag::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("SendTimeTag")
+    .SetParent<Tag> ()
+    .SetGroupName ("Tutorial")
+    .AddConstructor<SendTimeTag> ()
+    ;
+  return tid;
+}
+
+TypeId
+SendTimeTag::GetInstanceTypeId (void) const
+{
+  return GetTypeId ();
+}
+
+SendTimeTag::SendTimeTag ()
+  : m_sendNs (0)
+{
+}
+
+SendTimeTag::SendTimeTag (Time sendTime)
+  : m_sendNs (sendTime.GetNanoSeconds ())
+{
+}
+
+uint32_t
+SendTimeTag::GetSerializedSize (void) const
+{
+  return 8;
+}
+
+void
+SendTimeTag::Serialize (TagBuffer i) const
+{
+  i.WriteU64 (static_cast<uint64_t> (m_sendNs));
+}
+
+void
+SendTimeTag::Deserialize (TagBuffer i)
+{
+  m_sendNs = static_cast<int64_t> (i.ReadU64 ());
+}
+
+void
+SendTimeTag::Print (std::ostream &os) const
+{
+  os << "sent=" << m_sendNs << "ns";
+}
+
+Time
+SendTimeTag::GetSendTime (void) const
+{
+  return NanoSeconds (m_sendNs);
+}
+
+/**
+ * Event calling a member function of an object.  Its storage comes from
+ * and returns to a per-type free list, so scheduling one costs no heap
+ * allocation once the list has warmed up.  An owner that keeps a Ptr to
+ * one event can also schedule it again each time it has run, as MyApp
+ * does; a cancelled event stays cancelled and must be replaced.
+ */
+template <typename T>
+class MemberEvent : public EventImpl
+{
+public:
+  MemberEvent (T *object, void (T::*function) (void));
+
+  static void *operator new (std::size_t size);
+  static void operator delete (void *p);
+
+protected:
+  virtual void Notify (void);
+
+private:
+  static std::vector<void *> &FreeList (void);
+
+  T     *m_object;
+  void (T::*m_function) (void);
+};
+
+template <typename T>
+MemberEvent<T>::MemberEvent (T *object, void (T::*function) (void))
+  : m_object (object),
+    m_function (function)
+{
+}
+
+template <typename T>
+std::vector<void *> &
+MemberEvent<T>::FreeList (void)
+{
+  static std::vector<void *> freeList;
+  return freeList;
+}
+
+template <typename T>
+void *
+MemberEvent<T>::operator new (std::size_t size)
+{
+  std::vector<void *> &freeList = FreeList ();
+  if (freeList.empty ())
+    {
+      return ::operator new (size);
+    }
+  void *p = freeList.back ();
+  freeList.pop_back ();
+  return p;
+}
+
+template <typename T>
+void
+MemberEvent<T>::operator delete (void *p)
+{
+  FreeList ().push_back (p);
+}
+
+template <typename T>
+void
+MemberEvent<T>::Notify (void)
+{
+  (m_object->*m_function) ();
+}
+
+/**
+ * Simulator::Schedule (delay, function, object) on a pooled MemberEvent.
+ * \return The event id.
+ */
+template <typename T>
+static EventId
+ScheduleMember (Time delay, void (T::*function) (void), T *object)
+{
+  return Simulator::Schedule (delay, Ptr<EventImpl> (Create<MemberEvent<T> > (object, function)));
+}
+
 // ===========================================================================
 //
 //         node 0                 node 1
@@ -59,6 +574,20 @@ public:
    */
   static TypeId GetTypeId (void);
   void Setup (Ptr<Socket> socket, Address address, uint32_t packetSize, uint32_t nPackets, DataRate dataRate);
+  /**
+   * Draw each payload size from \p sizes instead of sending a fixed
+   * packetSize.  One payload template per size is built here, so sending
+   * only copies a template.
+   * \param sizes The size distribution.
+   */
+  void SetPacketSizeDistribution (Ptr<PacketSizeDistribution> sizes);
+  /** Add a SendTimeTag to every payload handed to the socket. */
+  void EnableSendTimeTags (void);
+  /**
+   * \param recycle Reschedule one MemberEvent for every send (the default)
+   *        instead of allocating a new event per packet.
+   */
+  void SetEventRecycling (bool recycle);
 
 private:
   virtual void StartApplication (void);
@@ -75,6 +604,14 @@ private:
   EventId         m_sendEvent;
   bool            m_running;
   uint32_t        m_packetsSent;
+  uint32_t        m_lastSize;
+  bool            m_sendTimeTags;
+  bool            m_recycleEvents;
+  Ptr<MemberEvent<MyApp> > m_txEvent;  //!< rescheduled for every send
+
+  Ptr<PacketSizeDistribution>    m_sizes;
+  Ptr<UniformRandomVariable>     m_sizeRng;
+  std::vector<Ptr<Packet> >      m_templates;
 };
 
 MyApp::MyApp ()
@@ -85,7 +622,12 @@ MyApp::MyApp ()
     m_dataRate (0),
     m_sendEvent (),
     m_running (false),
-    m_packetsSent (0)
+    m_packetsSent (0),
+    m_lastSize (0),
+    m_sendTimeTags (false),
+    m_recycleEvents (true),
+    m_sizes (0),
+    m_sizeRng (0)
 {
 }
 
@@ -115,6 +657,30 @@ MyApp::Setup (Ptr<Socket> socket, Address address, uint32_t packetSize, uint32_t
   m_dataRate = dataRate;
 }
 
+void
+MyApp::SetPacketSizeDistribution (Ptr<PacketSizeDistribution> sizes)
+{
+  m_sizes = sizes;
+  m_sizeRng = CreateObject<UniformRandomVariable> ();
+  m_templates.clear ();
+  for (uint32_t i = 0; i < sizes->GetN (); ++i)
+    {
+      m_templates.push_back (Create<Packet> (sizes->GetSize (i)));
+    }
+}
+
+void
+MyApp::EnableSendTimeTags (void)
+{
+  m_sendTimeTags = true;
+}
+
+void
+MyApp::SetEventRecycling (bool recycle)
+{
+  m_recycleEvents = recycle;
+}
+
 void
 MyApp::StartApplication (void)
 {
@@ -144,7 +710,20 @@ MyApp::StopApplication (void)
 void
 MyApp::SendPacket (void)
 {
-  Ptr<Packet> packet = Create<Packet> (m_packetSize);
+  Ptr<Packet> packet;
+  if (m_sizes)
+    {
+      packet = m_templates[m_sizes->Draw (m_sizeRng->GetValue ())]->Copy ();
+    }
+  else
+    {
+      packet = Create<Packet> (m_packetSize);
+    }
+  m_lastSize = packet->GetSize ();
+  if (m_sendTimeTags)
+    {
+      packet->AddByteTag (SendTimeTag (Simulator::Now ()));
+    }
   m_socket->Send (packet);
 
   if (++m_packetsSent < m_nPackets)
@@ -158,121 +737,5650 @@ MyApp::ScheduleTx (void)
 {
   if (m_running)
     {
-      Time tNext (Seconds (m_packetSize * 8 / static_cast<double> (m_dataRate.GetBitRate ())));
-      m_sendEvent = Simulator::Schedule (tNext, &MyApp::SendPacket, this);
+      Time tNext (Seconds (m_lastSize * 8 / static_cast<double> (m_dataRate.GetBitRate ())));
+      if (!m_recycleEvents)
+        {
+          m_sendEvent = Simulator::Schedule (tNext, &MyApp::SendPacket, this);
+          return;
+        }
+      // StopApplication cancels m_sendEvent, which marks m_txEvent for good.
+      if (!m_txEvent || m_txEvent->IsCancelled ())
+        {
+          m_txEvent = Create<MemberEvent<MyApp> > (this, &MyApp::SendPacket);
+        }
+      m_sendEvent = Simulator::Schedule (tNext, Ptr<EventImpl> (m_txEvent));
     }
 }
 
-static void
-CwndChange (Ptr<OutputStreamWrapper> stream, uint32_t oldCwnd, uint32_t newCwnd)
+#ifdef __cpp_impl_coroutine
+// ===========================================================================
+//
+// Coroutine traffic scripts.  MyApp spreads one send loop over
+// StartApplication, SendPacket, ScheduleTx and m_sendEvent; a SimTask lets
+// the same pattern be written as straight-line code:
+//
+//   for (;;)
+//     {
+//       co_await Writable (socket, size);
+//       socket->Send (Create<Packet> (size));
+//       co_await Sleep (gap);
+//     }
+//
+// Every suspension is backed by an ordinary simulator event or socket
+// callback, so scripts interleave with the rest of the simulation exactly
+// like hand-written applications.  Frames come from a size-class pool, which
+// keeps thousands of scripted flows cheap to start and tear down.
+// ===========================================================================
+//
+class CoroutineFramePool
 {
-  NS_LOG_UNCOND (Simulator::Now ().GetSeconds () << "\t" << newCwnd);
-  *stream->GetStream () << Simulator::Now ().GetSeconds () << "\t" << oldCwnd << "\t" << newCwnd << std::endl;
+public:
+  static CoroutineFramePool &Get (void);
+
+  void *Allocate (std::size_t size);
+  void Deallocate (void *p, std::size_t size);
+
+private:
+  static constexpr std::size_t GRANULE = 64;          //!< size-class width in bytes
+  static constexpr std::size_t CLASSES = 32;          //!< frames above 2 KiB bypass the pool
+  static constexpr std::size_t BLOCKS_PER_CHUNK = 64;
+
+  struct FreeBlock
+  {
+    FreeBlock *next;
+  };
+
+  FreeBlock *m_free[CLASSES] = {};
+  std::vector<std::unique_ptr<char[]> > m_chunks;
+};
+
+CoroutineFramePool &
+CoroutineFramePool::Get (void)
+{
+  static CoroutineFramePool pool;
+  return pool;
 }
 
-static void
-RxDrop (Ptr<PcapFileWrapper> file, Ptr<const Packet> p)
+void *
+CoroutineFramePool::Allocate (std::size_t size)
 {
-  NS_LOG_UNCOND ("RxDrop at " << Simulator::Now ().GetSeconds ());
-  file->Write (Simulator::Now (), p);
+  std::size_t cls = (size + GRANULE - 1) / GRANULE - 1;
+  if (cls >= CLASSES)
+    {
+      return ::operator new (size);
+    }
+  if (m_free[cls] == 0)
+    {
+      std::size_t blockSize = (cls + 1) * GRANULE;
+      m_chunks.emplace_back (new char[blockSize * BLOCKS_PER_CHUNK]);
+      char *chunk = m_chunks.back ().get ();
+      for (std::size_t i = 0; i < BLOCKS_PER_CHUNK; ++i)
+        {
+          FreeBlock *block = reinterpret_cast<FreeBlock *> (chunk + i * blockSize);
+          block->next = m_free[cls];
+          m_free[cls] = block;
+        }
+    }
+  FreeBlock *block = m_free[cls];
+  m_free[cls] = block->next;
+  return block;
 }
 
-int
-main (int argc, char *argv[])
+void
+CoroutineFramePool::Deallocate (void *p, std::size_t size)
 {
-  CommandLine cmd;
-  cmd.Parse (argc, argv);
+  std::size_t cls = (size + GRANULE - 1) / GRANULE - 1;
+  if (cls >= CLASSES)
+    {
+      ::operator delete (p);
+      return;
+    }
+  FreeBlock *block = static_cast<FreeBlock *> (p);
+  block->next = m_free[cls];
+  m_free[cls] = block;
+}
 
-  //NodeContainer nodes;
-  //nodes.Create (2);
-  /* Build nodes. */
-  NodeContainer term_0;
-  term_0.Create (1);
-  NodeContainer term_1;
-  term_1.Create (1);
-  NodeContainer term_2;
-  term_2.Create (1);
-  NodeContainer term_3;
-  term_3.Create (1);
-
-  PointToPointHelper pointToPoint_1, pointToPoint_2, pointToPoint_3;
-  pointToPoint_1.SetDeviceAttribute ("DataRate", StringValue ("5Mbps"));
-  pointToPoint_1.SetChannelAttribute ("Delay", StringValue ("2ms"));
-
-  pointToPoint_2.SetDeviceAttribute ("DataRate", StringValue ("5Mbps"));
-  pointToPoint_2.SetChannelAttribute ("Delay", StringValue ("2ms"));
-
-  pointToPoint_3.SetDeviceAttribute ("DataRate", StringValue ("5Mbps"));
-  pointToPoint_3.SetChannelAttribute ("Delay", StringValue ("2ms"));
+/**
+ * A simulator-driven coroutine.  The task starts suspended; Start () resumes
+ * it from a scheduled event.  Destroying the task cancels any pending resume
+ * and releases the frame, so an application can drop a script mid-flight.
+ */
+class SimTask
+{
+public:
+  struct promise_type
+  {
+    EventId m_resume;               //!< pending wake-up scheduled by Sleep or Start
+    bool    m_recycleEvents = false;  //!< Sleep on pooled MemberEvents
+
+    void Resume (void)
+    {
+      std::coroutine_handle<promise_type>::from_promise (*this).resume ();
+    }
+
+    SimTask get_return_object (void)
+    {
+      return SimTask (std::coroutine_handle<promise_type>::from_promise (*this));
+    }
+    std::suspend_always initial_suspend (void) noexcept { return {}; }
+    std::suspend_always final_suspend (void) noexcept { return {}; }
+    void return_void (void) {}
+    void unhandled_exception (void) { std::terminate (); }
+
+    static void *operator new (std::size_t size)
+    {
+      return CoroutineFramePool::Get ().Allocate (size);
+    }
+    static void operator delete (void *p, std::size_t size)
+    {
+      CoroutineFramePool::Get ().Deallocate (p, size);
+    }
+  };
+  typedef std::coroutine_handle<promise_type> Handle;
+
+  SimTask () : m_handle () {}
+  SimTask (SimTask &&o) noexcept : m_handle (std::exchange (o.m_handle, Handle ())) {}
+  SimTask &operator= (SimTask &&o) noexcept
+  {
+    if (this != &o)
+      {
+        Release ();
+        m_handle = std::exchange (o.m_handle, Handle ());
+      }
+    return *this;
+  }
+  SimTask (const SimTask &) = delete;
+  SimTask &operator= (const SimTask &) = delete;
+  ~SimTask () { Release (); }
+
+  void Start (void)
+  {
+    m_handle.promise ().m_resume = Simulator::ScheduleNow (&SimTask::Resume, m_handle.address ());
+  }
+  /** \param recycle Whether Sleep takes its wake-up events from the MemberEvent pool. */
+  void SetEventRecycling (bool recycle)
+  {
+    m_handle.promise ().m_recycleEvents = recycle;
+  }
+  bool IsDone (void) const { return !m_handle || m_handle.done (); }
+
+  static void Resume (void *address)
+  {
+    Handle::from_address (address).resume ();
+  }
+
+private:
+  explicit SimTask (Handle h) : m_handle (h) {}
+
+  void Release (void)
+  {
+    if (m_handle)
+      {
+        Simulator::Cancel (m_handle.promise ().m_resume);
+        m_handle.destroy ();
+        m_handle = Handle ();
+      }
+  }
+
+  Handle m_handle;
+};
+
+/**
+ * co_await Sleep (t): resume the calling script t from now.
+ */
+struct Sleep
+{
+  Time m_delay;
+
+  explicit Sleep (Time delay) : m_delay (delay) {}
+  bool await_ready (void) const noexcept { return false; }
+  void await_suspend (SimTask::Handle h)
+  {
+    SimTask::promise_type &p = h.promise ();
+    p.m_resume = p.m_recycleEvents
+      ? ScheduleMember (m_delay, &SimTask::promise_type::Resume, &p)
+      : Simulator::Schedule (m_delay, &SimTask::Resume, h.address ());
+  }
+  void await_resume (void) const noexcept {}
+};
+
+/**
+ * co_await Writable (socket, bytes): resume once the socket's send buffer
+ * can take \p bytes.  Completes immediately if it already can.
+ *
+ * While it waits, it owns the socket's send callback, and it leaves the
+ * callback null when it resumes or is destroyed (Socket has no getter, so
+ * a previous callback cannot be chained or restored).  A script that
+ * awaits Writable must not install a send callback of its own.
+ */
+class Writable
+{
+public:
+  Writable (Ptr<Socket> socket, uint32_t bytes) : m_socket (socket), m_bytes (bytes), m_waiting () {}
+  Writable (const Writable &) = delete;
+  Writable &operator= (const Writable &) = delete;
+  ~Writable () { Disarm (); }
+
+  bool await_ready (void) const { return m_socket->GetTxAvailable () >= m_bytes; }
+  void await_suspend (SimTask::Handle h)
+  {
+    m_waiting = h;
+    m_socket->SetSendCallback (MakeCallback (&Writable::OnSendSpace, this));
+  }
+  void await_resume (void) const noexcept {}
+
+private:
+  void OnSendSpace (Ptr<Socket> socket, uint32_t available)
+  {
+    if (available >= m_bytes)
+      {
+        SimTask::Handle h = m_waiting;
+        Disarm ();
+        h.resume ();
+      }
+  }
+  void Disarm (void)
+  {
+    if (m_waiting)
+      {
+        m_socket->SetSendCallback (MakeNullCallback<void, Ptr<Socket>, uint32_t> ());
+        m_waiting = SimTask::Handle ();
+      }
+  }
+
+  Ptr<Socket>     m_socket;
+  uint32_t        m_bytes;
+  SimTask::Handle m_waiting;
+};
+
+/**
+ * Application that runs a coroutine script against a connected socket.
+ */
+class ScriptedApp : public Application
+{
+public:
+  typedef std::function<SimTask (Ptr<Socket>)> Script;
+
+  ScriptedApp ();
+  virtual ~ScriptedApp ();
+
+  /**
+   * Register this type.
+   * \return The TypeId.
+   */
+  static TypeId GetTypeId (void);
+  void Setup (Ptr<Socket> socket, Address address, Script script);
+  /** \param recycle Whether the script sleeps on pooled events (see MyApp::SetEventRecycling). */
+  void SetEventRecycling (bool recycle);
+
+private:
+  virtual void StartApplication (void);
+  virtual void StopApplication (void);
+
+  Ptr<Socket>     m_socket;
+  Address         m_peer;
+  Script          m_script;
+  SimTask         m_task;
+  bool            m_recycleEvents;
+};
+
+ScriptedApp::ScriptedApp ()
+  : m_socket (0),
+    m_peer (),
+    m_script (),
+    m_task (),
+    m_recycleEvents (false)
+{
+}
+
+ScriptedApp::~ScriptedApp ()
+{
+  m_socket = 0;
+}
+
+/* static */
+TypeId ScriptedApp::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ScriptedApp")
+    .SetParent<Application> ()
+    .SetGroupName ("Tutorial")
+    .AddConstructor<ScriptedApp> ()
+    ;
+  return tid;
+}
+
+void
+ScriptedApp::Setup (Ptr<Socket> socket, Address address, Script script)
+{
+  m_socket = socket;
+  m_peer = address;
+  m_script = script;
+}
+
+void
+ScriptedApp::SetEventRecycling (bool recycle)
+{
+  m_recycleEvents = recycle;
+}
+
+void
+ScriptedApp::StartApplication (void)
+{
+  m_socket->Bind ();
+  m_socket->Connect (m_peer);
+  m_task = m_script (m_socket);
+  m_task.SetEventRecycling (m_recycleEvents);
+  m_task.Start ();
+}
+
+void
+ScriptedApp::StopApplication (void)
+{
+  m_task = SimTask ();
+
+  if (m_socket)
+    {
+      m_socket->Close ();
+    }
+}
+
+/**
+ * The MyApp send loop as a script: nPackets packets of packetSize bytes at
+ * dataRate, waiting for send-buffer space instead of dropping on a full one.
+ */
+static SimTask
+ConstantRateScript (Ptr<Socket> socket, uint32_t packetSize, uint32_t nPackets, DataRate dataRate)
+{
+  Time gap (Seconds (packetSize * 8 / static_cast<double> (dataRate.GetBitRate ())));
+  for (uint32_t i = 0; i < nPackets; ++i)
+    {
+      co_await Writable (socket, packetSize);
+      socket->Send (Create<Packet> (packetSize));
+      co_await Sleep (gap);
+    }
+}
+
+/**
+ * A ScriptedApp running ConstantRateScript, the --scripted counterpart of
+ * MyApp::Setup.
+ * \return The application.
+ */
+static Ptr<Application>
+ConstantRateApp (Ptr<Socket> socket, Address address, uint32_t packetSize, uint32_t nPackets,
+                 DataRate dataRate, bool recycleEvents)
+{
+  Ptr<ScriptedApp> app = CreateObject<ScriptedApp> ();
+  app->Setup (socket, address, [packetSize, nPackets, dataRate] (Ptr<Socket> s)
+    {
+      return ConstantRateScript (s, packetSize, nPackets, dataRate);
+    });
+  app->SetEventRecycling (recycleEvents);
+  return app;
+}
+#else /* __cpp_impl_coroutine */
+static Ptr<Application>
+ConstantRateApp (Ptr<Socket> socket, Address address, uint32_t packetSize, uint32_t nPackets,
+                 DataRate dataRate, bool recycleEvents)
+{
+  NS_FATAL_ERROR ("--scripted needs a C++20 build with coroutine support");
+  return 0;
+}
+#endif /* __cpp_impl_coroutine */
+
+// ===========================================================================
+//
+// Request/response (RPC) workload.  RpcClient issues requests as a Poisson
+// process with sizes from a PacketSizeDistribution, and RpcServer answers
+// each one with the number of bytes the request asked for.  A request starts
+// with an 8-byte header (request length, response length) so the server can
+// find request boundaries in the TCP byte stream.  Connections are either a
+// fixed set shared by all requests (pipelined and answered in order) or one
+// connection per request, closed once its response has arrived.
+//
+// Outstanding requests live in a preallocated slot table, threaded into a
+// FIFO per connection, and closed connection objects are kept for reuse, so
+// the steady state allocates nothing per request beyond the packets.
+// ===========================================================================
+//
+static const uint32_t RPC_HEADER_SIZE = 8;
+static const uint32_t RPC_NONE = 0xffffffff;
+
+struct RpcRequest
+{
+  Time     m_start;
+  uint32_t m_requestBytes;
+  uint32_t m_responseBytes;
+  uint32_t m_unsent;      //!< request bytes not yet accepted by the socket
+  uint32_t m_unreceived;  //!< response bytes still to arrive
+  uint32_t m_next;        //!< next request on the same connection, or RPC_NONE
+};
+
+class RpcClient;
+
+class RpcClientConnection : public SimpleRefCount<RpcClientConnection>
+{
+public:
+  explicit RpcClientConnection (RpcClient *client);
+
+  void Open (Ptr<Node> node, const Address &peer);
+  void Close (void);
+  bool IsOpen (void) const;
+  void Enqueue (uint32_t request);
+
+private:
+  void HandleRead (Ptr<Socket> socket);
+  void HandleSend (Ptr<Socket> socket, uint32_t available);
+  void Drain (void);
+
+  RpcClient   *m_client;
+  Ptr<Socket>  m_socket;
+  uint32_t     m_head;        //!< oldest request awaiting its response
+  uint32_t     m_tail;
+  uint32_t     m_sendCursor;  //!< first request with unsent bytes
+};
+
+class RpcClient : public Application
+{
+public:
+  RpcClient ();
+  virtual ~RpcClient ();
+
+  /**
+   * Register this type.
+   * \return The TypeId.
+   */
+  static TypeId GetTypeId (void);
+  void Setup (Address address, Ptr<PacketSizeDistribution> requestSizes, uint32_t responseSize,
+              double requestRate, bool reuseConnections, uint32_t nConnections, uint32_t maxOutstanding);
+  /** \param cb Called with each connection's socket right after it connects. */
+  void SetSocketCallback (Callback<void, Ptr<Socket> > cb);
+
+  const LatencyHistogram &GetCompletionTimes (void) const;
+  uint64_t GetIssued (void) const;
+  uint64_t GetCompleted (void) const;
+  uint64_t GetRejected (void) const;
+
+private:
+  friend class RpcClientConnection;
+
+  virtual void StartApplication (void);
+  virtual void StopApplication (void);
+
+  void IssueRequest (void);
+  void CompleteRequest (uint32_t request);
+  void ConnectionIdle (RpcClientConnection *connection);
+
+  Address                               m_peer;
+  Ptr<PacketSizeDistribution>           m_requestSizes;
+  uint32_t                              m_responseSize;
+  double                                m_requestRate;
+  bool                                  m_reuse;
+  uint32_t                              m_nConnections;
+  Ptr<UniformRandomVariable>            m_sizeRng;
+  Ptr<ExponentialRandomVariable>        m_gapRng;
+  std::vector<RpcRequest>               m_requests;
+  std::vector<uint32_t>                 m_freeRequests;
+  std::vector<Ptr<RpcClientConnection> > m_connections;  //!< every connection object ever opened
+  std::vector<Ptr<RpcClientConnection> > m_idle;         //!< closed per-request connections
+  uint32_t                              m_nextConnection;
+  EventId                               m_arrivalEvent;
+  bool                                  m_running;
+  LatencyHistogram                      m_completionTimes;
+  uint64_t                              m_issued;
+  uint64_t                              m_completed;
+  uint64_t                              m_rejected;
+  Callback<void, Ptr<Socket> >          m_socketCallback;
+};
+
+RpcClientConnection::RpcClientConnection (RpcClient *client)
+  : m_client (client),
+    m_socket (0),
+    m_head (RPC_NONE),
+    m_tail (RPC_NONE),
+    m_sendCursor (RPC_NONE)
+{
+}
+
+void
+RpcClientConnection::Open (Ptr<Node> node, const Address &peer)
+{
+  m_socket = Socket::CreateSocket (node, TcpSocketFactory::GetTypeId ());
+  m_socket->Bind ();
+  m_socket->Connect (peer);
+  m_socket->SetRecvCallback (MakeCallback (&RpcClientConnection::HandleRead, this));
+  m_socket->SetSendCallback (MakeCallback (&RpcClientConnection::HandleSend, this));
+  if (!m_client->m_socketCallback.IsNull ())
+    {
+      m_client->m_socketCallback (m_socket);
+    }
+}
+
+void
+RpcClientConnection::Close (void)
+{
+  if (m_socket)
+    {
+      m_socket->SetRecvCallback (MakeNullCallback<void, Ptr<Socket> > ());
+      m_socket->SetSendCallback (MakeNullCallback<void, Ptr<Socket>, uint32_t> ());
+      m_socket->Close ();
+      m_socket = 0;
+    }
+  m_head = m_tail = m_sendCursor = RPC_NONE;
+}
+
+bool
+RpcClientConnection::IsOpen (void) const
+{
+  return PeekPointer (m_socket) != 0;
+}
+
+void
+RpcClientConnection::Enqueue (uint32_t request)
+{
+  m_client->m_requests[request].m_next = RPC_NONE;
+  if (m_tail == RPC_NONE)
+    {
+      m_head = request;
+    }
+  else
+    {
+      m_client->m_requests[m_tail].m_next = request;
+    }
+  m_tail = request;
+  if (m_sendCursor == RPC_NONE)
+    {
+      m_sendCursor = request;
+    }
+  Drain ();
+}
+
+void
+RpcClientConnection::Drain (void)
+{
+  while (m_sendCursor != RPC_NONE)
+    {
+      RpcRequest &r = m_client->m_requests[m_sendCursor];
+      uint32_t available = m_socket->GetTxAvailable ();
+      if (available == 0)
+        {
+          return;
+        }
+      uint32_t offset = r.m_requestBytes - r.m_unsent;
+      Ptr<Packet> packet;
+      if (offset < RPC_HEADER_SIZE)
+        {
+          uint8_t header[RPC_HEADER_SIZE];
+          for (uint32_t i = 0; i < 4; ++i)
+            {
+              header[i] = r.m_requestBytes >> (24 - 8 * i);
+              header[4 + i] = r.m_responseBytes >> (24 - 8 * i);
+            }
+          packet = Create<Packet> (header + offset, std::min (available, RPC_HEADER_SIZE - offset));
+        }
+      else
+        {
+          packet = Create<Packet> (std::min (available, r.m_unsent));
+        }
+      if (m_socket->Send (packet) < 0)
+        {
+          return;
+        }
+      r.m_unsent -= packet->GetSize ();
+      if (r.m_unsent == 0)
+        {
+          m_sendCursor = r.m_next;
+        }
+    }
+}
+
+void
+RpcClientConnection::HandleSend (Ptr<Socket> socket, uint32_t available)
+{
+  Drain ();
+}
+
+void
+RpcClientConnection::HandleRead (Ptr<Socket> socket)
+{
+  Ptr<Packet> packet;
+  while ((packet = socket->Recv ()))
+    {
+      uint32_t bytes = packet->GetSize ();
+      while (bytes > 0 && m_head != RPC_NONE)
+        {
+          RpcRequest &r = m_client->m_requests[m_head];
+          uint32_t take = std::min (bytes, r.m_unreceived);
+          r.m_unreceived -= take;
+          bytes -= take;
+          if (r.m_unreceived == 0)
+            {
+              uint32_t done = m_head;
+              m_head = r.m_next;
+              if (m_head == RPC_NONE)
+                {
+                  m_tail = RPC_NONE;
+                }
+              m_client->CompleteRequest (done);
+            }
+        }
+    }
+  if (m_head == RPC_NONE)
+    {
+      m_client->ConnectionIdle (this);
+    }
+}
+
+RpcClient::RpcClient ()
+  : m_peer (),
+    m_requestSizes (0),
+    m_responseSize (0),
+    m_requestRate (0),
+    m_reuse (true),
+    m_nConnections (1),
+    m_sizeRng (0),
+    m_gapRng (0),
+    m_nextConnection (0),
+    m_arrivalEvent (),
+    m_running (false),
+    m_issued (0),
+    m_completed (0),
+    m_rejected (0)
+{
+}
+
+RpcClient::~RpcClient ()
+{
+}
+
+/* static */
+TypeId RpcClient::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("RpcClient")
+    .SetParent<Application> ()
+    .SetGroupName ("Tutorial")
+    .AddConstructor<RpcClient> ()
+    ;
+  return tid;
+}
+
+void
+RpcClient::Setup (Address address, Ptr<PacketSizeDistribution> requestSizes, uint32_t responseSize,
+                  double requestRate, bool reuseConnections, uint32_t nConnections, uint32_t maxOutstanding)
+{
+  m_peer = address;
+  m_requestSizes = requestSizes;
+  m_responseSize = std::max<uint32_t> (responseSize, 1);
+  m_requestRate = requestRate;
+  m_reuse = reuseConnections;
+  m_nConnections = std::max<uint32_t> (nConnections, 1);
+  m_requests.assign (maxOutstanding, RpcRequest ());
+  m_freeRequests.clear ();
+  for (uint32_t i = maxOutstanding; i > 0; --i)
+    {
+      m_freeRequests.push_back (i - 1);
+    }
+  m_connections.reserve (m_reuse ? m_nConnections : maxOutstanding);
+  m_idle.reserve (m_reuse ? 0 : maxOutstanding);
+}
+
+void
+RpcClient::SetSocketCallback (Callback<void, Ptr<Socket> > cb)
+{
+  m_socketCallback = cb;
+}
+
+const LatencyHistogram &
+RpcClient::GetCompletionTimes (void) const
+{
+  return m_completionTimes;
+}
+
+uint64_t
+RpcClient::GetIssued (void) const
+{
+  return m_issued;
+}
+
+uint64_t
+RpcClient::GetCompleted (void) const
+{
+  return m_completed;
+}
+
+uint64_t
+RpcClient::GetRejected (void) const
+{
+  return m_rejected;
+}
+
+void
+RpcClient::StartApplication (void)
+{
+  m_running = true;
+  m_sizeRng = CreateObject<UniformRandomVariable> ();
+  m_gapRng = CreateObject<ExponentialRandomVariable> ();
+  m_gapRng->SetAttribute ("Mean", DoubleValue (1.0 / m_requestRate));
+  if (m_reuse)
+    {
+      for (uint32_t i = 0; i < m_nConnections; ++i)
+        {
+          Ptr<RpcClientConnection> connection = Create<RpcClientConnection> (this);
+          connection->Open (GetNode (), m_peer);
+          m_connections.push_back (connection);
+        }
+    }
+  IssueRequest ();
+}
+
+void
+RpcClient::StopApplication (void)
+{
+  m_running = false;
+
+  if (m_arrivalEvent.IsRunning ())
+    {
+      Simulator::Cancel (m_arrivalEvent);
+    }
+
+  for (uint32_t i = 0; i < m_connections.size (); ++i)
+    {
+      m_connections[i]->Close ();
+    }
+}
+
+void
+RpcClient::IssueRequest (void)
+{
+  if (!m_running)
+    {
+      return;
+    }
+
+  if (m_freeRequests.empty ())
+    {
+      ++m_rejected;
+    }
+  else
+    {
+      uint32_t id = m_freeRequests.back ();
+      m_freeRequests.pop_back ();
+      RpcRequest &r = m_requests[id];
+      r.m_start = Simulator::Now ();
+      r.m_requestBytes = std::max (RPC_HEADER_SIZE, m_requestSizes->GetSize (m_requestSizes->Draw (m_sizeRng->GetValue ())));
+      r.m_responseBytes = m_responseSize;
+      r.m_unsent = r.m_requestBytes;
+      r.m_unreceived = r.m_responseBytes;
+
+      Ptr<RpcClientConnection> connection;
+      if (m_reuse)
+        {
+          connection = m_connections[m_nextConnection++ % m_connections.size ()];
+        }
+      else
+        {
+          if (m_idle.empty ())
+            {
+              connection = Create<RpcClientConnection> (this);
+              m_connections.push_back (connection);
+            }
+          else
+            {
+              connection = m_idle.back ();
+              m_idle.pop_back ();
+            }
+          connection->Open (GetNode (), m_peer);
+        }
+      connection->Enqueue (id);
+      ++m_issued;
+    }
+
+  m_arrivalEvent = ScheduleMember (Seconds (m_gapRng->GetValue ()), &RpcClient::IssueRequest, this);
+}
+
+void
+RpcClient::CompleteRequest (uint32_t request)
+{
+  m_completionTimes.Record (Simulator::Now () - m_requests[request].m_start);
+  ++m_completed;
+  m_freeRequests.push_back (request);
+}
+
+void
+RpcClient::ConnectionIdle (RpcClientConnection *connection)
+{
+  if (!m_reuse && connection->IsOpen ())
+    {
+      connection->Close ();
+      m_idle.push_back (connection);
+    }
+}
+
+class RpcServer;
+
+class RpcServerConnection : public SimpleRefCount<RpcServerConnection>
+{
+public:
+  RpcServerConnection (RpcServer *server, uint32_t index);
+
+  void Attach (Ptr<Socket> socket);
+  void Close (void);
+  bool IsOpen (void) const;
+
+private:
+  void HandleRead (Ptr<Socket> socket);
+  void HandleSend (Ptr<Socket> socket, uint32_t available);
+  void HandlePeerClose (Ptr<Socket> socket);
+  void Drain (void);
+
+  RpcServer           *m_server;
+  uint32_t             m_index;
+  Ptr<Socket>          m_socket;
+  uint8_t              m_header[RPC_HEADER_SIZE];
+  uint32_t             m_headerBytes;   //!< header bytes of the current request seen so far
+  uint32_t             m_bodyLeft;      //!< body bytes of the current request still to arrive
+  uint32_t             m_responseBytes;
+  uint64_t             m_replyPending;  //!< response bytes not yet accepted by the socket
+  std::vector<uint8_t> m_scratch;
+};
+
+class RpcServer : public Application
+{
+public:
+  RpcServer ();
+  virtual ~RpcServer ();
+
+  /**
+   * Register this type.
+   * \return The TypeId.
+   */
+  static TypeId GetTypeId (void);
+  void Setup (uint16_t port);
+  /** \param cb Called with each accepted socket. */
+  void SetSocketCallback (Callback<void, Ptr<Socket> > cb);
+
+private:
+  friend class RpcServerConnection;
+
+  virtual void StartApplication (void);
+  virtual void StopApplication (void);
+
+  void HandleAccept (Ptr<Socket> socket, const Address &from);
+  void ConnectionClosed (uint32_t index);
+
+  uint16_t                               m_port;
+  Ptr<Socket>                            m_socket;
+  std::vector<Ptr<RpcServerConnection> > m_connections;
+  std::vector<uint32_t>                  m_freeConnections;
+  Callback<void, Ptr<Socket> >           m_socketCallback;
+};
+
+RpcServerConnection::RpcServerConnection (RpcServer *server, uint32_t index)
+  : m_server (server),
+    m_index (index),
+    m_socket (0),
+    m_headerBytes (0),
+    m_bodyLeft (0),
+    m_responseBytes (0),
+    m_replyPending (0)
+{
+}
+
+void
+RpcServerConnection::Attach (Ptr<Socket> socket)
+{
+  m_socket = socket;
+  m_headerBytes = 0;
+  m_bodyLeft = 0;
+  m_replyPending = 0;
+  m_socket->SetRecvCallback (MakeCallback (&RpcServerConnection::HandleRead, this));
+  m_socket->SetSendCallback (MakeCallback (&RpcServerConnection::HandleSend, this));
+  m_socket->SetCloseCallbacks (MakeCallback (&RpcServerConnection::HandlePeerClose, this),
+                               MakeCallback (&RpcServerConnection::HandlePeerClose, this));
+}
+
+void
+RpcServerConnection::Close (void)
+{
+  if (m_socket)
+    {
+      m_socket->SetRecvCallback (MakeNullCallback<void, Ptr<Socket> > ());
+      m_socket->SetSendCallback (MakeNullCallback<void, Ptr<Socket>, uint32_t> ());
+      m_socket->SetCloseCallbacks (MakeNullCallback<void, Ptr<Socket> > (),
+                                   MakeNullCallback<void, Ptr<Socket> > ());
+      m_socket->Close ();
+      m_socket = 0;
+      m_server->ConnectionClosed (m_index);
+    }
+}
+
+bool
+RpcServerConnection::IsOpen (void) const
+{
+  return PeekPointer (m_socket) != 0;
+}
+
+void
+RpcServerConnection::HandleRead (Ptr<Socket> socket)
+{
+  Ptr<Packet> packet;
+  while ((packet = socket->Recv ()))
+    {
+      uint32_t size = packet->GetSize ();
+      if (m_scratch.size () < size)
+        {
+          m_scratch.resize (size);
+        }
+      packet->CopyData (m_scratch.data (), size);
+
+      uint32_t pos = 0;
+      while (pos < size)
+        {
+          if (m_headerBytes < RPC_HEADER_SIZE)
+            {
+              uint32_t n = std::min (RPC_HEADER_SIZE - m_headerBytes, size - pos);
+              std::copy (m_scratch.data () + pos, m_scratch.data () + pos + n, m_header + m_headerBytes);
+              m_headerBytes += n;
+              pos += n;
+              if (m_headerBytes < RPC_HEADER_SIZE)
+                {
+                  break;
+                }
+              uint32_t requestBytes = 0;
+              m_responseBytes = 0;
+              for (uint32_t i = 0; i < 4; ++i)
+                {
+                  requestBytes = (requestBytes << 8) | m_header[i];
+                  m_responseBytes = (m_responseBytes << 8) | m_header[4 + i];
+                }
+              m_bodyLeft = requestBytes - RPC_HEADER_SIZE;
+            }
+          uint32_t n = std::min (m_bodyLeft, size - pos);
+          m_bodyLeft -= n;
+          pos += n;
+          if (m_bodyLeft == 0)
+            {
+              m_replyPending += m_responseBytes;
+              m_headerBytes = 0;
+            }
+        }
+    }
+  Drain ();
+}
+
+void
+RpcServerConnection::HandleSend (Ptr<Socket> socket, uint32_t available)
+{
+  Drain ();
+}
+
+void
+RpcServerConnection::HandlePeerClose (Ptr<Socket> socket)
+{
+  Close ();
+}
+
+void
+RpcServerConnection::Drain (void)
+{
+  while (m_socket && m_replyPending > 0)
+    {
+      uint32_t available = m_socket->GetTxAvailable ();
+      if (available == 0)
+        {
+          return;
+        }
+      uint32_t n = static_cast<uint32_t> (std::min<uint64_t> (m_replyPending, available));
+      if (m_socket->Send (Create<Packet> (n)) < 0)
+        {
+          return;
+        }
+      m_replyPending -= n;
+    }
+}
+
+RpcServer::RpcServer ()
+  : m_port (0),
+    m_socket (0)
+{
+}
+
+RpcServer::~RpcServer ()
+{
+  m_socket = 0;
+}
+
+/* static */
+TypeId RpcServer::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("RpcServer")
+    .SetParent<Application> ()
+    .SetGroupName ("Tutorial")
+    .AddConstructor<RpcServer> ()
+    ;
+  return tid;
+}
+
+void
+RpcServer::Setup (uint16_t port)
+{
+  m_port = port;
+}
+
+void
+RpcServer::SetSocketCallback (Callback<void, Ptr<Socket> > cb)
+{
+  m_socketCallback = cb;
+}
+
+void
+RpcServer::StartApplication (void)
+{
+  m_socket = Socket::CreateSocket (GetNode (), TcpSocketFactory::GetTypeId ());
+  m_socket->Bind (InetSocketAddress (Ipv4Address::GetAny (), m_port));
+  m_socket->Listen ();
+  m_socket->SetAcceptCallback (MakeNullCallback<bool, Ptr<Socket>, const Address &> (),
+                               MakeCallback (&RpcServer::HandleAccept, this));
+}
+
+void
+RpcServer::StopApplication (void)
+{
+  for (uint32_t i = 0; i < m_connections.size (); ++i)
+    {
+      m_connections[i]->Close ();
+    }
+  if (m_socket)
+    {
+      m_socket->Close ();
+    }
+}
+
+void
+RpcServer::HandleAccept (Ptr<Socket> socket, const Address &from)
+{
+  if (m_freeConnections.empty ())
+    {
+      m_connections.push_back (Create<RpcServerConnection> (this, m_connections.size ()));
+      m_freeConnections.push_back (m_connections.size () - 1);
+    }
+  uint32_t index = m_freeConnections.back ();
+  m_freeConnections.pop_back ();
+  if (!m_socketCallback.IsNull ())
+    {
+      m_socketCallback (socket);
+    }
+  m_connections[index]->Attach (socket);
+}
+
+void
+RpcServer::ConnectionClosed (uint32_t index)
+{
+  m_freeConnections.push_back (index);
+}
+
+// ===========================================================================
+//
+// Data-center style short flows.  ShortFlowGenerator opens one TCP
+// connection per flow, with Poisson arrivals and heavy-tailed sizes, sends a
+// 12-byte header (flow size, start time in ns) and the flow body.  FlowSink
+// on the far end records the flow completion time when the last byte
+// arrives, into one histogram per size bucket, and closes first; the
+// generator closes its end when the sink's FIN comes in.
+//
+// Per-flow state lives in pooled objects on both ends.  The end that closes
+// first holds the connection in TIME_WAIT for twice the maximum segment
+// lifetime; leaving that to the sink keeps term_0's ephemeral ports free,
+// while term_3 only keeps one TIME_WAIT endpoint per recent flow on its
+// listening port.  Memory thus follows the concurrent flows plus the flows
+// of the last 2 MSL, not the total number of flows in the run.
+// ===========================================================================
+//
+static const uint32_t FLOW_HEADER_SIZE = 12;
+
+class ShortFlowGenerator;
+
+class ShortFlow : public SimpleRefCount<ShortFlow>
+{
+public:
+  explicit ShortFlow (ShortFlowGenerator *generator);
+
+  /**
+   * Open the connection and start sending.
+   * \return Whether the socket could be bound and connected.
+   */
+  bool Start (Ptr<Node> node, const Address &peer, uint32_t size);
+  void Abort (void);
+
+private:
+  void HandleSend (Ptr<Socket> socket, uint32_t available);
+  void HandleClose (Ptr<Socket> socket);
+  void Drain (void);
+
+  ShortFlowGenerator *m_generator;
+  Ptr<Socket>         m_socket;
+  uint32_t            m_size;
+  uint32_t            m_unsent;
+  int64_t             m_startNs;
+};
+
+class ShortFlowGenerator : public Application
+{
+public:
+  ShortFlowGenerator ();
+  virtual ~ShortFlowGenerator ();
+
+  /**
+   * Register this type.
+   * \return The TypeId.
+   */
+  static TypeId GetTypeId (void);
+  /**
+   * \param address The FlowSink address.
+   * \param sizes Flow size sampler, in bytes.
+   * \param flowRate Mean flow arrivals per second.
+   * \param maxFlows Flows to start in total; zero for no limit.
+   * \param maxActive Concurrent flows; arrivals beyond this, and those whose
+   *        socket cannot be bound or connected, are rejected.
+   */
+  void Setup (Address address, Ptr<RandomVariableStream> sizes, double flowRate, uint64_t maxFlows, uint32_t maxActive);
+  /** \param cb Called with each flow's socket right after it connects. */
+  void SetSocketCallback (Callback<void, Ptr<Socket> > cb);
+
+  uint64_t GetStarted (void) const;
+  uint64_t GetRejected (void) const;
+  uint32_t GetPoolSize (void) const;
+
+private:
+  friend class ShortFlow;
+
+  virtual void StartApplication (void);
+  virtual void StopApplication (void);
+
+  void StartFlow (void);
+  void FlowDone (ShortFlow *flow);
+
+  Address                      m_peer;
+  Ptr<RandomVariableStream>    m_sizes;
+  double                       m_flowRate;
+  uint64_t                     m_maxFlows;
+  uint32_t                     m_maxActive;
+  Ptr<ExponentialRandomVariable> m_gapRng;
+  std::vector<Ptr<ShortFlow> > m_flows;  //!< every flow object ever created
+  std::vector<ShortFlow *>     m_free;
+  EventId                      m_arrivalEvent;
+  bool                         m_running;
+  uint64_t                     m_started;
+  uint64_t                     m_rejected;
+  Callback<void, Ptr<Socket> > m_socketCallback;
+};
+
+ShortFlow::ShortFlow (ShortFlowGenerator *generator)
+  : m_generator (generator),
+    m_socket (0),
+    m_size (0),
+    m_unsent (0),
+    m_startNs (0)
+{
+}
+
+bool
+ShortFlow::Start (Ptr<Node> node, const Address &peer, uint32_t size)
+{
+  m_size = size;
+  m_unsent = FLOW_HEADER_SIZE + size;
+  m_startNs = Simulator::Now ().GetNanoSeconds ();
+  m_socket = Socket::CreateSocket (node, TcpSocketFactory::GetTypeId ());
+  if (m_socket->Bind () < 0 || m_socket->Connect (peer) < 0)
+    {
+      // Typically no ephemeral port left on the node.
+      Abort ();
+      return false;
+    }
+  m_socket->SetSendCallback (MakeCallback (&ShortFlow::HandleSend, this));
+  m_socket->SetCloseCallbacks (MakeCallback (&ShortFlow::HandleClose, this),
+                               MakeCallback (&ShortFlow::HandleClose, this));
+  if (!m_generator->m_socketCallback.IsNull ())
+    {
+      m_generator->m_socketCallback (m_socket);
+    }
+  Drain ();
+  return true;
+}
+
+void
+ShortFlow::Abort (void)
+{
+  if (m_socket)
+    {
+      m_socket->SetSendCallback (MakeNullCallback<void, Ptr<Socket>, uint32_t> ());
+      m_socket->SetCloseCallbacks (MakeNullCallback<void, Ptr<Socket> > (),
+                                   MakeNullCallback<void, Ptr<Socket> > ());
+      m_socket->Close ();
+      m_socket = 0;
+    }
+}
+
+void
+ShortFlow::HandleSend (Ptr<Socket> socket, uint32_t available)
+{
+  Drain ();
+}
+
+void
+ShortFlow::HandleClose (Ptr<Socket> socket)
+{
+  // The sink closed after the last byte (or the connection failed): close
+  // our end passively, so TIME_WAIT stays on the sink, and free the slot.
+  Abort ();
+  m_generator->FlowDone (this);
+}
+
+void
+ShortFlow::Drain (void)
+{
+  while (m_unsent > 0)
+    {
+      uint32_t available = m_socket->GetTxAvailable ();
+      if (available == 0)
+        {
+          return;
+        }
+      uint32_t offset = FLOW_HEADER_SIZE + m_size - m_unsent;
+      Ptr<Packet> packet;
+      if (offset < FLOW_HEADER_SIZE)
+        {
+          uint8_t header[FLOW_HEADER_SIZE];
+          for (uint32_t i = 0; i < 4; ++i)
+            {
+              header[i] = m_size >> (24 - 8 * i);
+            }
+          for (uint32_t i = 0; i < 8; ++i)
+            {
+              header[4 + i] = static_cast<uint64_t> (m_startNs) >> (56 - 8 * i);
+            }
+          packet = Create<Packet> (header + offset, std::min (available, FLOW_HEADER_SIZE - offset));
+        }
+      else
+        {
+          packet = Create<Packet> (std::min (available, m_unsent));
+        }
+      if (m_socket->Send (packet) < 0)
+        {
+          return;
+        }
+      m_unsent -= packet->GetSize ();
+    }
+}
+
+ShortFlowGenerator::ShortFlowGenerator ()
+  : m_peer (),
+    m_sizes (0),
+    m_flowRate (0),
+    m_maxFlows (0),
+    m_maxActive (0),
+    m_gapRng (0),
+    m_arrivalEvent (),
+    m_running (false),
+    m_started (0),
+    m_rejected (0)
+{
+}
+
+ShortFlowGenerator::~ShortFlowGenerator ()
+{
+}
+
+/* static */
+TypeId ShortFlowGenerator::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ShortFlowGenerator")
+    .SetParent<Application> ()
+    .SetGroupName ("Tutorial")
+    .AddConstructor<ShortFlowGenerator> ()
+    ;
+  return tid;
+}
+
+void
+ShortFlowGenerator::Setup (Address address, Ptr<RandomVariableStream> sizes, double flowRate, uint64_t maxFlows, uint32_t maxActive)
+{
+  m_peer = address;
+  m_sizes = sizes;
+  m_flowRate = flowRate;
+  m_maxFlows = maxFlows;
+  m_maxActive = maxActive;
+}
+
+void
+ShortFlowGenerator::SetSocketCallback (Callback<void, Ptr<Socket> > cb)
+{
+  m_socketCallback = cb;
+}
+
+uint64_t
+ShortFlowGenerator::GetStarted (void) const
+{
+  return m_started;
+}
+
+uint64_t
+ShortFlowGenerator::GetRejected (void) const
+{
+  return m_rejected;
+}
+
+uint32_t
+ShortFlowGenerator::GetPoolSize (void) const
+{
+  return m_flows.size ();
+}
+
+void
+ShortFlowGenerator::StartApplication (void)
+{
+  m_running = true;
+  m_gapRng = CreateObject<ExponentialRandomVariable> ();
+  m_gapRng->SetAttribute ("Mean", DoubleValue (1.0 / m_flowRate));
+  StartFlow ();
+}
+
+void
+ShortFlowGenerator::StopApplication (void)
+{
+  m_running = false;
+
+  if (m_arrivalEvent.IsRunning ())
+    {
+      Simulator::Cancel (m_arrivalEvent);
+    }
+
+  for (uint32_t i = 0; i < m_flows.size (); ++i)
+    {
+      m_flows[i]->Abort ();
+    }
+}
+
+void
+ShortFlowGenerator::StartFlow (void)
+{
+  if (!m_running || (m_maxFlows > 0 && m_started + m_rejected >= m_maxFlows))
+    {
+      return;
+    }
+
+  if (m_free.empty () && m_flows.size () < m_maxActive)
+    {
+      m_flows.push_back (Create<ShortFlow> (this));
+      m_free.push_back (PeekPointer (m_flows.back ()));
+    }
+  if (m_free.empty ())
+    {
+      ++m_rejected;
+    }
+  else
+    {
+      ShortFlow *flow = m_free.back ();
+      m_free.pop_back ();
+      if (flow->Start (GetNode (), m_peer, std::max<uint32_t> (m_sizes->GetInteger (), 1)))
+        {
+          ++m_started;
+        }
+      else
+        {
+          ++m_rejected;
+          m_free.push_back (flow);
+        }
+    }
+
+  m_arrivalEvent = ScheduleMember (Seconds (m_gapRng->GetValue ()), &ShortFlowGenerator::StartFlow, this);
+}
+
+void
+ShortFlowGenerator::FlowDone (ShortFlow *flow)
+{
+  m_free.push_back (flow);
+}
+
+class FlowSink;
+
+class FlowSinkConnection : public SimpleRefCount<FlowSinkConnection>
+{
+public:
+  FlowSinkConnection (FlowSink *sink, uint32_t index);
+
+  void Attach (Ptr<Socket> socket);
+  void Close (void);
+
+private:
+  void HandleRead (Ptr<Socket> socket);
+  void HandlePeerClose (Ptr<Socket> socket);
+
+  FlowSink            *m_sink;
+  uint32_t             m_index;
+  Ptr<Socket>          m_socket;
+  uint8_t              m_header[FLOW_HEADER_SIZE];
+  uint32_t             m_headerBytes;
+  uint32_t             m_bodyLeft;
+  bool                 m_done;      //!< flow recorded; ignore anything after it
+  std::vector<uint8_t> m_scratch;
+};
+
+class FlowSink : public Application
+{
+public:
+  FlowSink ();
+  virtual ~FlowSink ();
+
+  /**
+   * Register this type.
+   * \return The TypeId.
+   */
+  static TypeId GetTypeId (void);
+  /**
+   * \param port Listening port.
+   * \param bucketEdges Ascending upper size bounds of the FCT buckets; flows
+   *        above the last edge go to a final overflow bucket.
+   */
+  void Setup (uint16_t port, std::vector<uint32_t> bucketEdges);
+
+  uint64_t GetCompleted (void) const;
+  uint32_t GetPoolSize (void) const;
+  /**
+   * Print one FCT summary line per size bucket.
+   * \param os The output stream.
+   */
+  void PrintReport (std::ostream &os) const;
+
+private:
+  friend class FlowSinkConnection;
+
+  virtual void StartApplication (void);
+  virtual void StopApplication (void);
+
+  void HandleAccept (Ptr<Socket> socket, const Address &from);
+  void FlowCompleted (uint32_t size, int64_t startNs);
+  void ConnectionClosed (uint32_t index);
+
+  uint16_t                              m_port;
+  Ptr<Socket>                           m_socket;
+  std::vector<uint32_t>                 m_bucketEdges;
+  std::vector<LatencyHistogram>         m_fct;
+  std::vector<Ptr<FlowSinkConnection> > m_connections;
+  std::vector<uint32_t>                 m_freeConnections;
+  uint64_t                              m_completed;
+};
+
+FlowSinkConnection::FlowSinkConnection (FlowSink *sink, uint32_t index)
+  : m_sink (sink),
+    m_index (index),
+    m_socket (0),
+    m_headerBytes (0),
+    m_bodyLeft (0),
+    m_done (false)
+{
+}
+
+void
+FlowSinkConnection::Attach (Ptr<Socket> socket)
+{
+  m_socket = socket;
+  m_headerBytes = 0;
+  m_bodyLeft = 0;
+  m_done = false;
+  m_socket->SetRecvCallback (MakeCallback (&FlowSinkConnection::HandleRead, this));
+  m_socket->SetCloseCallbacks (MakeCallback (&FlowSinkConnection::HandlePeerClose, this),
+                               MakeCallback (&FlowSinkConnection::HandlePeerClose, this));
+}
+
+void
+FlowSinkConnection::Close (void)
+{
+  if (m_socket)
+    {
+      m_socket->SetRecvCallback (MakeNullCallback<void, Ptr<Socket> > ());
+      m_socket->SetCloseCallbacks (MakeNullCallback<void, Ptr<Socket> > (),
+                                   MakeNullCallback<void, Ptr<Socket> > ());
+      m_socket->Close ();
+      m_socket = 0;
+      m_sink->ConnectionClosed (m_index);
+    }
+}
+
+void
+FlowSinkConnection::HandleRead (Ptr<Socket> socket)
+{
+  Ptr<Packet> packet;
+  while ((packet = socket->Recv ()))
+    {
+      if (m_done)
+        {
+          continue;
+        }
+      uint32_t size = packet->GetSize ();
+      uint32_t pos = 0;
+      if (m_headerBytes < FLOW_HEADER_SIZE)
+        {
+          if (m_scratch.size () < size)
+            {
+              m_scratch.resize (size);
+            }
+          packet->CopyData (m_scratch.data (), size);
+          uint32_t n = std::min (FLOW_HEADER_SIZE - m_headerBytes, size);
+          std::copy (m_scratch.data (), m_scratch.data () + n, m_header + m_headerBytes);
+          m_headerBytes += n;
+          pos = n;
+          if (m_headerBytes < FLOW_HEADER_SIZE)
+            {
+              continue;
+            }
+          m_bodyLeft = 0;
+          for (uint32_t i = 0; i < 4; ++i)
+            {
+              m_bodyLeft = (m_bodyLeft << 8) | m_header[i];
+            }
+        }
+      m_bodyLeft -= std::min (m_bodyLeft, size - pos);
+      if (m_bodyLeft == 0)
+        {
+          uint32_t flowSize = 0;
+          uint64_t startNs = 0;
+          for (uint32_t i = 0; i < 4; ++i)
+            {
+              flowSize = (flowSize << 8) | m_header[i];
+            }
+          for (uint32_t i = 0; i < 8; ++i)
+            {
+              startNs = (startNs << 8) | m_header[4 + i];
+            }
+          m_sink->FlowCompleted (flowSize, static_cast<int64_t> (startNs));
+          m_done = true;
+          // Close first, so the connection's TIME_WAIT is kept here and not
+          // on the generator's ephemeral port.
+          Close ();
+          return;
+        }
+    }
+}
+
+void
+FlowSinkConnection::HandlePeerClose (Ptr<Socket> socket)
+{
+  Close ();
+}
+
+FlowSink::FlowSink ()
+  : m_port (0),
+    m_socket (0),
+    m_completed (0)
+{
+}
+
+FlowSink::~FlowSink ()
+{
+  m_socket = 0;
+}
+
+/* static */
+TypeId FlowSink::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("FlowSink")
+    .SetParent<Application> ()
+    .SetGroupName ("Tutorial")
+    .AddConstructor<FlowSink> ()
+    ;
+  return tid;
+}
+
+void
+FlowSink::Setup (uint16_t port, std::vector<uint32_t> bucketEdges)
+{
+  m_port = port;
+  m_bucketEdges = bucketEdges;
+  m_fct.assign (bucketEdges.size () + 1, LatencyHistogram ());
+}
+
+uint64_t
+FlowSink::GetCompleted (void) const
+{
+  return m_completed;
+}
+
+uint32_t
+FlowSink::GetPoolSize (void) const
+{
+  return m_connections.size ();
+}
+
+void
+FlowSink::PrintReport (std::ostream &os) const
+{
+  for (uint32_t i = 0; i < m_fct.size (); ++i)
+    {
+      std::ostringstream label;
+      label << "fct ";
+      if (i < m_bucketEdges.size ())
+        {
+          label << "<=" << m_bucketEdges[i] << "B";
+        }
+      else
+        {
+          label << ">" << (m_bucketEdges.empty () ? 0 : m_bucketEdges.back ()) << "B";
+        }
+      m_fct[i].PrintSummary (os, label.str ());
+    }
+}
+
+void
+FlowSink::StartApplication (void)
+{
+  m_socket = Socket::CreateSocket (GetNode (), TcpSocketFactory::GetTypeId ());
+  m_socket->Bind (InetSocketAddress (Ipv4Address::GetAny (), m_port));
+  m_socket->Listen ();
+  m_socket->SetAcceptCallback (MakeNullCallback<bool, Ptr<Socket>, const Address &> (),
+                               MakeCallback (&FlowSink::HandleAccept, this));
+}
+
+void
+FlowSink::StopApplication (void)
+{
+  for (uint32_t i = 0; i < m_connections.size (); ++i)
+    {
+      m_connections[i]->Close ();
+    }
+  if (m_socket)
+    {
+      m_socket->Close ();
+    }
+}
+
+void
+FlowSink::HandleAccept (Ptr<Socket> socket, const Address &from)
+{
+  if (m_freeConnections.empty ())
+    {
+      m_connections.push_back (Create<FlowSinkConnection> (this, m_connections.size ()));
+      m_freeConnections.push_back (m_connections.size () - 1);
+    }
+  uint32_t index = m_freeConnections.back ();
+  m_freeConnections.pop_back ();
+  m_connections[index]->Attach (socket);
+}
+
+void
+FlowSink::FlowCompleted (uint32_t size, int64_t startNs)
+{
+  uint32_t bucket = std::lower_bound (m_bucketEdges.begin (), m_bucketEdges.end (), size) - m_bucketEdges.begin ();
+  m_fct[bucket].Record (static_cast<uint64_t> (std::max<int64_t> (Simulator::Now ().GetNanoSeconds () - startNs, 0)));
+  ++m_completed;
+}
+
+void
+FlowSink::ConnectionClosed (uint32_t index)
+{
+  m_freeConnections.push_back (index);
+}
+
+/**
+ * Capture filter over the IPv4 and TCP headers of a PPP frame, compiled
+ * from a small expression language into postfix code.  Matches () reads at
+ * most the first 122 bytes of the frame into a stack buffer, so a packet
+ * that does not match costs neither a Packet copy nor a pcap write.
+ *
+ * Grammar:
+ *   expr    := term { "or" term }
+ *   term    := factor { "and" factor }
+ *   factor  := "not" factor | "(" expr ")" | field op value | keyword
+ *   field   := src dst host sport dport port proto ttl tos len payload seq ack win
+ *   op      := == != < <= > >=
+ *   keyword := ip tcp syn fin rst psh ack urg ece cwr ce retx
+ *
+ * Addresses are dotted quads; "host" and "port" match either direction.
+ * "retx" keeps the highest sequence number sent per flow and matches data
+ * segments that do not advance it.  Example: "syn or (retx and dport == 1090)".
+ */
+class CaptureFilter
+{
+public:
+  /**
+   * \param expression Filter source; the empty string matches everything.
+   * \return The compiled filter.  A syntax error is fatal.
+   */
+  static CaptureFilter Compile (std::string expression);
+
+  bool Matches (Ptr<const Packet> p);
+
+  /** Header fields of a PPP frame; tcp is false for non-TCP packets. */
+  struct Fields
+  {
+    bool     ip;
+    bool     tcp;
+    uint32_t src;
+    uint32_t dst;
+    uint8_t  proto;
+    uint8_t  ttl;
+    uint8_t  tos;
+    uint16_t len;
+    uint16_t sport;
+    uint16_t dport;
+    uint32_t seq;
+    uint32_t ack;
+    uint8_t  flags;
+    uint16_t win;
+    uint32_t payload;
+  };
+
+  /**
+   * \param p A PPP frame.
+   * \param f Filled with the IPv4 and TCP fields present.
+   * \return Whether \p p carries IPv4.
+   */
+  static bool Decode (Ptr<const Packet> p, Fields &f);
+
+private:
+  enum Field { SRC, DST, HOST, SPORT, DPORT, PORT, PROTO, TTL, TOS, LEN, PAYLOAD, SEQ, ACKNO, WIN };
+  enum Op { CMP, IS_IP, IS_TCP, FLAG, CE, RETX, AND, OR, NOT, TRUE };
+  enum Cmp { EQ, NE, LT, LE, GT, GE };
+
+  struct Instr
+  {
+    Op       op;
+    Field    field;
+    Cmp      cmp;
+    uint32_t value;
+  };
+
+  CaptureFilter ();
+
+  // Recursive-descent parser; each level appends its postfix code.
+  std::string NextToken (void);
+  std::string PeekToken (void);
+  void ParseExpr (void);
+  void ParseTerm (void);
+  void ParseFactor (void);
+  static uint32_t ParseValue (std::string token);
+
+  static bool Compare (uint32_t a, Cmp cmp, uint32_t b);
+  bool IsRetransmission (const Fields &f);
+
+  std::vector<Instr>                     m_code;
+  bool                                   m_stateful;
+  std::unordered_map<uint64_t, uint32_t> m_highestSeq;  //!< per-flow end of the highest segment seen
+  std::string                            m_source;
+  std::size_t                            m_pos;
+};
+
+CaptureFilter::CaptureFilter ()
+  : m_stateful (false),
+    m_pos (0)
+{
+}
+
+CaptureFilter
+CaptureFilter::Compile (std::string expression)
+{
+  CaptureFilter filter;
+  filter.m_source = expression;
+  if (filter.PeekToken ().empty ())
+    {
+      filter.m_code.push_back (Instr {TRUE, SRC, EQ, 0});
+      return filter;
+    }
+  filter.ParseExpr ();
+  if (!filter.PeekToken ().empty ())
+    {
+      NS_FATAL_ERROR ("Capture filter \"" << expression << "\": unexpected \"" << filter.PeekToken () << "\"");
+    }
+  return filter;
+}
+
+std::string
+CaptureFilter::PeekToken (void)
+{
+  std::size_t saved = m_pos;
+  std::string token = NextToken ();
+  m_pos = saved;
+  return token;
+}
+
+std::string
+CaptureFilter::NextToken (void)
+{
+  while (m_pos < m_source.size () && std::isspace (static_cast<unsigned char> (m_source[m_pos])))
+    {
+      ++m_pos;
+    }
+  if (m_pos == m_source.size ())
+    {
+      return "";
+    }
+  std::size_t start = m_pos;
+  char c = m_source[m_pos];
+  if (c == '(' || c == ')')
+    {
+      ++m_pos;
+    }
+  else if (c == '=' || c == '!' || c == '<' || c == '>')
+    {
+      ++m_pos;
+      if (m_pos < m_source.size () && m_source[m_pos] == '=')
+        {
+          ++m_pos;
+        }
+    }
+  else
+    {
+      while (m_pos < m_source.size ()
+             && (std::isalnum (static_cast<unsigned char> (m_source[m_pos])) || m_source[m_pos] == '.'))
+        {
+          ++m_pos;
+        }
+      if (m_pos == start)
+        {
+          NS_FATAL_ERROR ("Capture filter \"" << m_source << "\": bad character '" << c << "'");
+        }
+    }
+  return m_source.substr (start, m_pos - start);
+}
+
+void
+CaptureFilter::ParseExpr (void)
+{
+  ParseTerm ();
+  while (PeekToken () == "or")
+    {
+      NextToken ();
+      ParseTerm ();
+      m_code.push_back (Instr {OR, SRC, EQ, 0});
+    }
+}
+
+void
+CaptureFilter::ParseTerm (void)
+{
+  ParseFactor ();
+  while (PeekToken () == "and")
+    {
+      NextToken ();
+      ParseFactor ();
+      m_code.push_back (Instr {AND, SRC, EQ, 0});
+    }
+}
+
+void
+CaptureFilter::ParseFactor (void)
+{
+  static const std::map<std::string, Field> fields = {
+    {"src", SRC}, {"dst", DST}, {"host", HOST}, {"sport", SPORT}, {"dport", DPORT},
+    {"port", PORT}, {"proto", PROTO}, {"ttl", TTL}, {"tos", TOS}, {"len", LEN},
+    {"payload", PAYLOAD}, {"seq", SEQ}, {"ack", ACKNO}, {"win", WIN}
+  };
+  static const std::map<std::string, Cmp> cmps = {
+    {"==", EQ}, {"!=", NE}, {"<", LT}, {"<=", LE}, {">", GT}, {">=", GE}
+  };
+  static const std::map<std::string, uint8_t> flags = {
+    {"fin", 0x01}, {"syn", 0x02}, {"rst", 0x04}, {"psh", 0x08},
+    {"ack", 0x10}, {"urg", 0x20}, {"ece", 0x40}, {"cwr", 0x80}
+  };
+
+  std::string token = NextToken ();
+  if (token == "not")
+    {
+      ParseFactor ();
+      m_code.push_back (Instr {NOT, SRC, EQ, 0});
+      return;
+    }
+  if (token == "(")
+    {
+      ParseExpr ();
+      if (NextToken () != ")")
+        {
+          NS_FATAL_ERROR ("Capture filter \"" << m_source << "\": missing \")\"");
+        }
+      return;
+    }
+  std::map<std::string, Field>::const_iterator field = fields.find (token);
+  if (field != fields.end () && cmps.count (PeekToken ()))
+    {
+      Cmp cmp = cmps.at (NextToken ());
+      m_code.push_back (Instr {CMP, field->second, cmp, ParseValue (NextToken ())});
+      return;
+    }
+  if (token == "ip")
+    {
+      m_code.push_back (Instr {IS_IP, SRC, EQ, 0});
+    }
+  else if (token == "tcp")
+    {
+      m_code.push_back (Instr {IS_TCP, SRC, EQ, 0});
+    }
+  else if (token == "ce")
+    {
+      m_code.push_back (Instr {CE, SRC, EQ, 0});
+    }
+  else if (token == "retx")
+    {
+      m_code.push_back (Instr {RETX, SRC, EQ, 0});
+      m_stateful = true;
+    }
+  else if (flags.count (token))
+    {
+      m_code.push_back (Instr {FLAG, SRC, EQ, flags.at (token)});
+    }
+  else
+    {
+      NS_FATAL_ERROR ("Capture filter \"" << m_source << "\": unexpected \"" << token << "\"");
+    }
+}
+
+uint32_t
+CaptureFilter::ParseValue (std::string token)
+{
+  uint32_t value = 0;
+  if (token.find ('.') != std::string::npos)
+    {
+      return Ipv4Address (token.c_str ()).Get ();
+    }
+  const char *end = token.data () + token.size ();
+  if (token.empty () || std::from_chars (token.data (), end, value).ptr != end)
+    {
+      NS_FATAL_ERROR ("Capture filter: bad value \"" << token << "\"");
+    }
+  return value;
+}
+
+bool
+CaptureFilter::Decode (Ptr<const Packet> p, Fields &f)
+{
+  // PPP (2) + IPv4 with options (60) + TCP with options (60).
+  uint8_t b[122];
+  uint32_t n = p->CopyData (b, sizeof (b));
+  f.ip = f.tcp = false;
+  if (n < 22 || b[0] != 0x00 || b[1] != 0x21 || (b[2] >> 4) != 4)
+    {
+      return false;
+    }
+  const uint8_t *ip = b + 2;
+  uint32_t ihl = (ip[0] & 0x0f) * 4;
+  f.ip = true;
+  f.tos = ip[1];
+  f.len = (ip[2] << 8) | ip[3];
+  f.ttl = ip[8];
+  f.proto = ip[9];
+  f.src = (uint32_t (ip[12]) << 24) | (ip[13] << 16) | (ip[14] << 8) | ip[15];
+  f.dst = (uint32_t (ip[16]) << 24) | (ip[17] << 16) | (ip[18] << 8) | ip[19];
+  if (f.proto != 6 || n < 2 + ihl + 20)
+    {
+      return true;
+    }
+  const uint8_t *tcp = ip + ihl;
+  uint32_t thl = (tcp[12] >> 4) * 4;
+  f.tcp = true;
+  f.sport = (tcp[0] << 8) | tcp[1];
+  f.dport = (tcp[2] << 8) | tcp[3];
+  f.seq = (uint32_t (tcp[4]) << 24) | (tcp[5] << 16) | (tcp[6] << 8) | tcp[7];
+  f.ack = (uint32_t (tcp[8]) << 24) | (tcp[9] << 16) | (tcp[10] << 8) | tcp[11];
+  f.flags = tcp[13];
+  f.win = (tcp[14] << 8) | tcp[15];
+  f.payload = f.len > ihl + thl ? f.len - ihl - thl : 0;
+  return true;
+}
+
+bool
+CaptureFilter::Compare (uint32_t a, Cmp cmp, uint32_t b)
+{
+  switch (cmp)
+    {
+    case EQ: return a == b;
+    case NE: return a != b;
+    case LT: return a < b;
+    case LE: return a <= b;
+    case GT: return a > b;
+    case GE: return a >= b;
+    }
+  return false;
+}
+
+bool
+CaptureFilter::IsRetransmission (const Fields &f)
+{
+  if (!f.tcp || f.payload == 0)
+    {
+      return false;
+    }
+  uint64_t key = (uint64_t (f.src ^ (f.dst * 2654435761u)) << 32) | (uint32_t (f.sport) << 16) | f.dport;
+  uint32_t end = f.seq + f.payload;
+  std::unordered_map<uint64_t, uint32_t>::iterator it = m_highestSeq.find (key);
+  if (it == m_highestSeq.end ())
+    {
+      m_highestSeq[key] = end;
+      return false;
+    }
+  if (static_cast<int32_t> (end - it->second) <= 0)
+    {
+      return true;
+    }
+  it->second = end;
+  return false;
+}
+
+bool
+CaptureFilter::Matches (Ptr<const Packet> p)
+{
+  Fields f;
+  Decode (p, f);
+  bool retx = m_stateful && IsRetransmission (f);
+
+  bool stack[64];
+  uint32_t top = 0;
+  for (const Instr &in : m_code)
+    {
+      bool r = false;
+      switch (in.op)
+        {
+        case AND:
+          --top;
+          stack[top - 1] = stack[top - 1] && stack[top];
+          continue;
+        case OR:
+          --top;
+          stack[top - 1] = stack[top - 1] || stack[top];
+          continue;
+        case NOT:
+          stack[top - 1] = !stack[top - 1];
+          continue;
+        case TRUE:
+          r = true;
+          break;
+        case IS_IP:
+          r = f.ip;
+          break;
+        case IS_TCP:
+          r = f.tcp;
+          break;
+        case FLAG:
+          r = f.tcp && (f.flags & in.value);
+          break;
+        case CE:
+          r = f.ip && (f.tos & 0x03) == 0x03;
+          break;
+        case RETX:
+          r = retx;
+          break;
+        case CMP:
+          switch (in.field)
+            {
+            case SRC: r = f.ip && Compare (f.src, in.cmp, in.value); break;
+            case DST: r = f.ip && Compare (f.dst, in.cmp, in.value); break;
+            case HOST: r = f.ip && (Compare (f.src, in.cmp, in.value) || Compare (f.dst, in.cmp, in.value)); break;
+            case PROTO: r = f.ip && Compare (f.proto, in.cmp, in.value); break;
+            case TTL: r = f.ip && Compare (f.ttl, in.cmp, in.value); break;
+            case TOS: r = f.ip && Compare (f.tos, in.cmp, in.value); break;
+            case LEN: r = f.ip && Compare (f.len, in.cmp, in.value); break;
+            case SPORT: r = f.tcp && Compare (f.sport, in.cmp, in.value); break;
+            case DPORT: r = f.tcp && Compare (f.dport, in.cmp, in.value); break;
+            case PORT: r = f.tcp && (Compare (f.sport, in.cmp, in.value) || Compare (f.dport, in.cmp, in.value)); break;
+            case PAYLOAD: r = f.tcp && Compare (f.payload, in.cmp, in.value); break;
+            case SEQ: r = f.tcp && Compare (f.seq, in.cmp, in.value); break;
+            case ACKNO: r = f.tcp && Compare (f.ack, in.cmp, in.value); break;
+            case WIN: r = f.tcp && Compare (f.win, in.cmp, in.value); break;
+            }
+          break;
+        }
+      if (top == sizeof (stack))
+        {
+          NS_FATAL_ERROR ("Capture filter \"" << m_source << "\" is nested too deeply");
+        }
+      stack[top++] = r;
+    }
+  return top > 0 && stack[top - 1];
+}
+
+/**
+ * pcap file fed through a CaptureFilter; connect Capture to a device's
+ * Sniffer trace source.
+ */
+class FilteredCapture : public SimpleRefCount<FilteredCapture>
+{
+public:
+  FilteredCapture (const CaptureFilter &filter, Ptr<PcapFileWrapper> file);
+
+  void Capture (Ptr<const Packet> p);
+  uint64_t GetSeen (void) const;
+  uint64_t GetWritten (void) const;
+
+private:
+  CaptureFilter        m_filter;
+  Ptr<PcapFileWrapper> m_file;
+  uint64_t             m_seen;
+  uint64_t             m_written;
+};
+
+FilteredCapture::FilteredCapture (const CaptureFilter &filter, Ptr<PcapFileWrapper> file)
+  : m_filter (filter),
+    m_file (file),
+    m_seen (0),
+    m_written (0)
+{
+}
+
+void
+FilteredCapture::Capture (Ptr<const Packet> p)
+{
+  ++m_seen;
+  if (m_filter.Matches (p))
+    {
+      ++m_written;
+      m_file->Write (Simulator::Now (), p);
+    }
+}
+
+uint64_t
+FilteredCapture::GetSeen (void) const
+{
+  return m_seen;
+}
+
+uint64_t
+FilteredCapture::GetWritten (void) const
+{
+  return m_written;
+}
+
+/**
+ * FIFO queue disc that marks CE on every ECN-capable packet arriving while
+ * the backlog is at or above MarkThreshold packets, the step marking DCTCP
+ * expects from a switch.  Arrivals beyond MaxSize are tail-dropped.
+ */
+class StepMarkQueueDisc : public QueueDisc
+{
+public:
+  /**
+   * Register this type.
+   * \return The TypeId.
+   */
+  static TypeId GetTypeId (void);
+  StepMarkQueueDisc ();
+  virtual ~StepMarkQueueDisc ();
+
+  uint64_t GetMarks (void) const;
+
+private:
+  virtual bool DoEnqueue (Ptr<QueueDiscItem> item);
+  virtual Ptr<QueueDiscItem> DoDequeue (void);
+  virtual bool CheckConfig (void);
+  virtual void InitializeParams (void);
+
+  uint32_t m_threshold;
+  uint64_t m_marks;
+};
+
+/* static */
+TypeId StepMarkQueueDisc::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("StepMarkQueueDisc")
+    .SetParent<QueueDisc> ()
+    .SetGroupName ("Tutorial")
+    .AddConstructor<StepMarkQueueDisc> ()
+    .AddAttribute ("MaxSize",
+                   "The maximum number of packets accepted by this queue disc.",
+                   QueueSizeValue (QueueSize ("1000p")),
+                   MakeQueueSizeAccessor (&QueueDisc::SetMaxSize,
+                                          &QueueDisc::GetMaxSize),
+                   MakeQueueSizeChecker ())
+    .AddAttribute ("MarkThreshold",
+                   "Backlog in packets at which ECN-capable arrivals are marked CE.",
+                   UintegerValue (20),
+                   MakeUintegerAccessor (&StepMarkQueueDisc::m_threshold),
+                   MakeUintegerChecker<uint32_t> ())
+    ;
+  return tid;
+}
+
+StepMarkQueueDisc::StepMarkQueueDisc ()
+  : QueueDisc (QueueDiscSizePolicy::SINGLE_INTERNAL_QUEUE),
+    m_threshold (20),
+    m_marks (0)
+{
+}
+
+StepMarkQueueDisc::~StepMarkQueueDisc ()
+{
+}
+
+uint64_t
+StepMarkQueueDisc::GetMarks (void) const
+{
+  return m_marks;
+}
+
+bool
+StepMarkQueueDisc::DoEnqueue (Ptr<QueueDiscItem> item)
+{
+  if (GetCurrentSize () + item > GetMaxSize ())
+    {
+      DropBeforeEnqueue (item, "Queue disc limit exceeded");
+      return false;
+    }
+  if (GetInternalQueue (0)->GetNPackets () >= m_threshold && Mark (item, "Step threshold exceeded"))
+    {
+      ++m_marks;
+    }
+  return GetInternalQueue (0)->Enqueue (item);
+}
+
+Ptr<QueueDiscItem>
+StepMarkQueueDisc::DoDequeue (void)
+{
+  return GetInternalQueue (0)->Dequeue ();
+}
+
+bool
+StepMarkQueueDisc::CheckConfig (void)
+{
+  if (GetNQueueDiscClasses () > 0 || GetNPacketFilters () > 0)
+    {
+      NS_LOG_ERROR ("StepMarkQueueDisc takes no classes or packet filters");
+      return false;
+    }
+  if (GetNInternalQueues () == 0)
+    {
+      AddInternalQueue (CreateObjectWithAttributes<DropTailQueue<QueueDiscItem> >
+                          ("MaxSize", QueueSizeValue (GetMaxSize ())));
+    }
+  return GetNInternalQueues () == 1;
+}
+
+void
+StepMarkQueueDisc::InitializeParams (void)
+{
+}
+
+/**
+ * Periodic sampler of a queue disc backlog; writes "time packets" lines and
+ * keeps the running mean.
+ */
+class QueueSampler : public SimpleRefCount<QueueSampler>
+{
+public:
+  QueueSampler (Ptr<QueueDisc> queue, Ptr<OutputStreamWrapper> stream, Time interval);
+
+  void Start (void);
+  double GetMean (void) const;
+
+private:
+  void Sample (void);
+
+  Ptr<QueueDisc>           m_queue;
+  Ptr<OutputStreamWrapper> m_stream;
+  Time                     m_interval;
+  uint64_t                 m_samples;
+  double                   m_sum;
+};
+
+QueueSampler::QueueSampler (Ptr<QueueDisc> queue, Ptr<OutputStreamWrapper> stream, Time interval)
+  : m_queue (queue),
+    m_stream (stream),
+    m_interval (interval),
+    m_samples (0),
+    m_sum (0)
+{
+}
+
+void
+QueueSampler::Start (void)
+{
+  Simulator::ScheduleNow (&QueueSampler::Sample, this);
+}
+
+double
+QueueSampler::GetMean (void) const
+{
+  return m_samples ? m_sum / m_samples : 0;
+}
+
+void
+QueueSampler::Sample (void)
+{
+  uint32_t packets = m_queue->GetNPackets ();
+  ++m_samples;
+  m_sum += packets;
+  *m_stream->GetStream () << Simulator::Now ().GetSeconds () << "\t" << packets << "\n";
+  ScheduleMember (m_interval, &QueueSampler::Sample, this);
+}
+
+/**
+ * \return The root queue disc in front of \p device (installed by
+ *         Ipv4AddressHelper::Assign unless set up earlier), or 0.
+ */
+static Ptr<QueueDisc>
+GetRootQueueDisc (Ptr<NetDevice> device)
+{
+  Ptr<TrafficControlLayer> tc = device->GetNode ()->GetObject<TrafficControlLayer> ();
+  return tc ? tc->GetRootQueueDiscOnDevice (device) : 0;
+}
+
+/**
+ * Connect \p sink to the drops of the root queue disc in front of
+ * \p device, where congestion losses happen: the device queue behind it
+ * is flow-controlled and rarely fires MacTxDrop.  Only DropBeforeEnqueue
+ * and DropAfterDequeue are connected, since the queue disc's Drop trace
+ * fires for both and would count every drop twice.
+ * \return Whether the device has a root queue disc.
+ */
+static bool
+ConnectQueueDiscDrops (Ptr<NetDevice> device, Callback<void, Ptr<const QueueDiscItem>, const char *> sink)
+{
+  Ptr<QueueDisc> qdisc = GetRootQueueDisc (device);
+  if (!qdisc)
+    {
+      return false;
+    }
+  qdisc->TraceConnectWithoutContext ("DropBeforeEnqueue", sink);
+  qdisc->TraceConnectWithoutContext ("DropAfterDequeue", sink);
+  return true;
+}
+
+/**
+ * Per-flow ECMP for the fan-out nodes of --paths.  Packets to a prefix with
+ * several next hops are spread by a hash of their five-tuple, so all the
+ * segments of one flow take the same path.  Ipv4GlobalRouting only offers
+ * per-packet spraying (RandomEcmpRouting); this protocol sits above it in
+ * the node's Ipv4ListRouting and declines every packet it has no multipath
+ * route for.
+ */
+class FlowEcmpRouting : public Ipv4RoutingProtocol
+{
+public:
+  /**
+   * Register this type.
+   * \return The TypeId.
+   */
+  static TypeId GetTypeId (void);
+  FlowEcmpRouting ();
+  virtual ~FlowEcmpRouting ();
+
+  /**
+   * \param network Destination prefix.
+   * \param mask Destination prefix mask.
+   * \param nextHops (gateway, interface) pairs to spread the prefix over.
+   */
+  void AddMultipathRoute (Ipv4Address network, Ipv4Mask mask,
+                          std::vector<std::pair<Ipv4Address, uint32_t> > nextHops);
+
+  virtual Ptr<Ipv4Route> RouteOutput (Ptr<Packet> p, const Ipv4Header &header,
+                                      Ptr<NetDevice> oif, Socket::SocketErrno &sockerr);
+  virtual bool RouteInput (Ptr<const Packet> p, const Ipv4Header &header, Ptr<const NetDevice> idev,
+                           const UnicastForwardCallback &ucb, const MulticastForwardCallback &mcb,
+                           const LocalDeliverCallback &lcb, const ErrorCallback &ecb);
+  virtual void NotifyInterfaceUp (uint32_t interface);
+  virtual void NotifyInterfaceDown (uint32_t interface);
+  virtual void NotifyAddAddress (uint32_t interface, Ipv4InterfaceAddress address);
+  virtual void NotifyRemoveAddress (uint32_t interface, Ipv4InterfaceAddress address);
+  virtual void SetIpv4 (Ptr<Ipv4> ipv4);
+  virtual void PrintRoutingTable (Ptr<OutputStreamWrapper> stream, Time::Unit unit = Time::S) const;
+
+private:
+  struct MultipathRoute
+  {
+    Ipv4Address                                    network;
+    Ipv4Mask                                       mask;
+    std::vector<std::pair<Ipv4Address, uint32_t> > nextHops;
+  };
+
+  static uint64_t FlowHash (Ptr<const Packet> p, const Ipv4Header &header);
+
+  Ptr<Ipv4>                   m_ipv4;
+  std::vector<MultipathRoute> m_routes;
+};
+
+/* static */
+TypeId FlowEcmpRouting::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("FlowEcmpRouting")
+    .SetParent<Ipv4RoutingProtocol> ()
+    .SetGroupName ("Tutorial")
+    .AddConstructor<FlowEcmpRouting> ()
+    ;
+  return tid;
+}
+
+FlowEcmpRouting::FlowEcmpRouting ()
+{
+}
+
+FlowEcmpRouting::~FlowEcmpRouting ()
+{
+}
+
+void
+FlowEcmpRouting::AddMultipathRoute (Ipv4Address network, Ipv4Mask mask,
+                                    std::vector<std::pair<Ipv4Address, uint32_t> > nextHops)
+{
+  NS_ABORT_MSG_IF (nextHops.empty (), "Multipath route without next hops");
+  m_routes.push_back (MultipathRoute {network, mask, nextHops});
+}
+
+uint64_t
+FlowEcmpRouting::FlowHash (Ptr<const Packet> p, const Ipv4Header &header)
+{
+  // The L4 header leads the packet once Ipv4L3Protocol has removed the IP header.
+  uint8_t ports[4] = {0, 0, 0, 0};
+  if (header.GetProtocol () == 6 || header.GetProtocol () == 17)
+    {
+      p->CopyData (ports, sizeof (ports));
+    }
+  uint64_t h = (uint64_t (header.GetSource ().Get ()) << 32) | header.GetDestination ().Get ();
+  h ^= (uint64_t (header.GetProtocol ()) << 56)
+       ^ ((uint32_t (ports[0]) << 24) | (ports[1] << 16) | (ports[2] << 8) | ports[3]) * 0x9e3779b97f4a7c15ULL;
+  // MurmurHash3 finalizer.
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+Ptr<Ipv4Route>
+FlowEcmpRouting::RouteOutput (Ptr<Packet> p, const Ipv4Header &header,
+                              Ptr<NetDevice> oif, Socket::SocketErrno &sockerr)
+{
+  // Fan-out nodes only forward; local traffic is left to the global routes.
+  sockerr = Socket::ERROR_NOROUTETOHOST;
+  return 0;
+}
+
+bool
+FlowEcmpRouting::RouteInput (Ptr<const Packet> p, const Ipv4Header &header, Ptr<const NetDevice> idev,
+                             const UnicastForwardCallback &ucb, const MulticastForwardCallback &mcb,
+                             const LocalDeliverCallback &lcb, const ErrorCallback &ecb)
+{
+  if (!m_ipv4->IsForwarding (m_ipv4->GetInterfaceForDevice (idev)))
+    {
+      return false;
+    }
+  for (const MultipathRoute &route : m_routes)
+    {
+      if (!route.mask.IsMatch (header.GetDestination (), route.network))
+        {
+          continue;
+        }
+      const std::pair<Ipv4Address, uint32_t> &nextHop = route.nextHops[FlowHash (p, header) % route.nextHops.size ()];
+      Ptr<Ipv4Route> rtentry = Create<Ipv4Route> ();
+      rtentry->SetDestination (header.GetDestination ());
+      rtentry->SetGateway (nextHop.first);
+      rtentry->SetSource (m_ipv4->GetAddress (nextHop.second, 0).GetLocal ());
+      rtentry->SetOutputDevice (m_ipv4->GetNetDevice (nextHop.second));
+      ucb (rtentry, p, header);
+      return true;
+    }
+  return false;
+}
+
+void
+FlowEcmpRouting::NotifyInterfaceUp (uint32_t interface)
+{
+}
+
+void
+FlowEcmpRouting::NotifyInterfaceDown (uint32_t interface)
+{
+}
+
+void
+FlowEcmpRouting::NotifyAddAddress (uint32_t interface, Ipv4InterfaceAddress address)
+{
+}
+
+void
+FlowEcmpRouting::NotifyRemoveAddress (uint32_t interface, Ipv4InterfaceAddress address)
+{
+}
+
+void
+FlowEcmpRouting::SetIpv4 (Ptr<Ipv4> ipv4)
+{
+  m_ipv4 = ipv4;
+}
+
+void
+FlowEcmpRouting::PrintRoutingTable (Ptr<OutputStreamWrapper> stream, Time::Unit unit) const
+{
+  std::ostream &os = *stream->GetStream ();
+  for (const MultipathRoute &route : m_routes)
+    {
+      os << route.network << " via";
+      for (const std::pair<Ipv4Address, uint32_t> &nextHop : route.nextHops)
+        {
+          os << " " << nextHop.first << "/if" << nextHop.second;
+        }
+      os << std::endl;
+    }
+}
+
+/**
+ * Reordering seen by the receiver of a multipath run.  Both ends keep a
+ * "retx" CaptureFilter: at the sender it counts data segments that did not
+ * advance the flow (retransmissions), at the receiver segments that arrived
+ * below the highest sequence already received (retransmissions plus
+ * reordering).  The difference is the reordering the paths introduced.
+ */
+class ReorderProbe : public SimpleRefCount<ReorderProbe>
+{
+public:
+  ReorderProbe ();
+
+  /** Connect to the Sniffer trace of the sender's first device. */
+  void SenderSniffer (Ptr<const Packet> p);
+  /** Connect to the Sniffer trace of the receiver's last device. */
+  void ReceiverSniffer (Ptr<const Packet> p);
+
+  uint64_t GetRetransmitted (void) const;
+  uint64_t GetLate (void) const;
+  /** \return Late arrivals not explained by retransmissions. */
+  uint64_t GetReordered (void) const;
+
+private:
+  CaptureFilter m_sender;
+  CaptureFilter m_receiver;
+  uint64_t      m_retransmitted;
+  uint64_t      m_late;
+};
+
+ReorderProbe::ReorderProbe ()
+  : m_sender (CaptureFilter::Compile ("retx")),
+    m_receiver (CaptureFilter::Compile ("retx")),
+    m_retransmitted (0),
+    m_late (0)
+{
+}
+
+void
+ReorderProbe::SenderSniffer (Ptr<const Packet> p)
+{
+  if (m_sender.Matches (p))
+    {
+      ++m_retransmitted;
+    }
+}
+
+void
+ReorderProbe::ReceiverSniffer (Ptr<const Packet> p)
+{
+  if (m_receiver.Matches (p))
+    {
+      ++m_late;
+    }
+}
+
+uint64_t
+ReorderProbe::GetRetransmitted (void) const
+{
+  return m_retransmitted;
+}
+
+uint64_t
+ReorderProbe::GetLate (void) const
+{
+  return m_late;
+}
+
+uint64_t
+ReorderProbe::GetReordered (void) const
+{
+  return m_late > m_retransmitted ? m_late - m_retransmitted : 0;
+}
+
+static void
+CountPacket (uint64_t *count, Ptr<const Packet> p)
+{
+  ++*count;
+}
+
+/**
+ * Per-hop timestamps carried by a sampled packet.  Hop 0 is term_0's
+ * egress, hop i the i-th forwarding node; each records the arrival, the
+ * start and the end of transmission as nanosecond offsets from the stamp
+ * time.  Hops beyond MAX_HOPS are not recorded.
+ */
+class HopTimestampTag : public Tag
+{
+public:
+  static constexpr uint32_t MAX_HOPS = 8;
+  enum Event { ARRIVE, DEPART, SENT };
+
+  /**
+   * Register this type.
+   * \return The TypeId.
+   */
+  static TypeId GetTypeId (void);
+  virtual TypeId GetInstanceTypeId (void) const;
+  virtual uint32_t GetSerializedSize (void) const;
+  virtual void Serialize (TagBuffer i) const;
+  virtual void Deserialize (TagBuffer i);
+  virtual void Print (std::ostream &os) const;
+
+  HopTimestampTag ();
+
+  /** Start a new record at the current time. */
+  void Stamp (void);
+  /** Note the arrival at the current hop. */
+  void Arrive (void);
+  /**
+   * Note the start of transmission at the current hop, and its end after
+   * \p transmission, then move on to the next hop.
+   */
+  void Depart (Time transmission);
+  uint32_t GetHops (void) const;
+  /** \return Offset of \p event at \p hop from the stamp time, in ns. */
+  uint32_t Get (uint32_t hop, Event event) const;
+  int64_t GetOrigin (void) const;
+
+private:
+  int64_t  m_origin;
+  uint8_t  m_hops;
+  uint32_t m_times[MAX_HOPS][3];
+};
+
+/* static */
+TypeId HopTimestampTag::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("HopTimestampTag")
+    .SetParent<Tag> ()
+    .SetGroupName ("Tutorial")
+    .AddConstructor<HopTimestampTag> ()
+    ;
+  return tid;
+}
+
+TypeId
+HopTimestampTag::GetInstanceTypeId (void) const
+{
+  return GetTypeId ();
+}
+
+HopTimestampTag::HopTimestampTag ()
+  : m_origin (0),
+    m_hops (0)
+{
+}
+
+uint32_t
+HopTimestampTag::GetSerializedSize (void) const
+{
+  uint32_t partial = m_hops < MAX_HOPS ? 1 : 0;
+  return 8 + 1 + (m_hops + partial) * sizeof (m_times[0]);
+}
+
+void
+HopTimestampTag::Serialize (TagBuffer i) const
+{
+  i.WriteU64 (static_cast<uint64_t> (m_origin));
+  i.WriteU8 (m_hops);
+  for (uint32_t h = 0; h < std::min<uint32_t> (m_hops + 1, MAX_HOPS); ++h)
+    {
+      for (uint32_t e = 0; e < 3; ++e)
+        {
+          i.WriteU32 (m_times[h][e]);
+        }
+    }
+}
+
+void
+HopTimestampTag::Deserialize (TagBuffer i)
+{
+  m_origin = static_cast<int64_t> (i.ReadU64 ());
+  m_hops = i.ReadU8 ();
+  for (uint32_t h = 0; h < std::min<uint32_t> (m_hops + 1, MAX_HOPS); ++h)
+    {
+      for (uint32_t e = 0; e < 3; ++e)
+        {
+          m_times[h][e] = i.ReadU32 ();
+        }
+    }
+}
+
+void
+HopTimestampTag::Print (std::ostream &os) const
+{
+  os << "origin=" << m_origin << " hops=" << uint32_t (m_hops);
+}
+
+void
+HopTimestampTag::Stamp (void)
+{
+  m_origin = Simulator::Now ().GetNanoSeconds ();
+  m_hops = 0;
+  m_times[0][ARRIVE] = 0;
+}
+
+void
+HopTimestampTag::Arrive (void)
+{
+  if (m_hops == MAX_HOPS)
+    {
+      return;
+    }
+  int64_t offset = Simulator::Now ().GetNanoSeconds () - m_origin;
+  m_times[m_hops][ARRIVE] = static_cast<uint32_t> (std::min<int64_t> (offset, UINT32_MAX));
+}
+
+void
+HopTimestampTag::Depart (Time transmission)
+{
+  if (m_hops == MAX_HOPS)
+    {
+      return;
+    }
+  int64_t offset = Simulator::Now ().GetNanoSeconds () - m_origin;
+  m_times[m_hops][DEPART] = static_cast<uint32_t> (std::min<int64_t> (offset, UINT32_MAX));
+  offset += transmission.GetNanoSeconds ();
+  m_times[m_hops][SENT] = static_cast<uint32_t> (std::min<int64_t> (offset, UINT32_MAX));
+  ++m_hops;
+}
+
+uint32_t
+HopTimestampTag::GetHops (void) const
+{
+  return m_hops;
+}
+
+uint32_t
+HopTimestampTag::Get (uint32_t hop, Event event) const
+{
+  return m_times[hop][event];
+}
+
+int64_t
+HopTimestampTag::GetOrigin (void) const
+{
+  return m_origin;
+}
+
+/**
+ * Hop-by-hop latency breakdown.  One in every N packets leaving term_0 gets
+ * a HopTimestampTag; forwarding nodes record arrival (PhyRxEnd) and start
+ * of transmission (PhyTxBegin), and term_3 folds the tag into per-hop
+ * queueing (arrival to start) and transmission (start to end) histograms.
+ * Hop 0 is stamped on MacTx, so its queueing covers term_0's device queue
+ * but not its queue disc.  Unsampled packets only pay a failed tag lookup.
+ *
+ * The tag is updated only where the trace hands out the packet that goes
+ * on: MacRx and PhyTxEnd see copies (the device and the channel copy the
+ * packet), and the packet tag list is copy-on-write.  So the end of a
+ * transmission is not observed but computed as its start plus the
+ * serialized size at the device's DataRate.
+ */
+class HopLatencyProbe : public SimpleRefCount<HopLatencyProbe>
+{
+public:
+  /** \param sampleEvery Tag one in this many packets leaving term_0. */
+  HopLatencyProbe (uint32_t sampleEvery);
+
+  /** Connect to MacTx of term_0's devices. */
+  void Stamp (Ptr<const Packet> p);
+  /** Connect to PhyRxEnd of forwarding nodes' devices. */
+  void Arrive (Ptr<const Packet> p);
+  /**
+   * Bind to PhyTxBegin of term_0's and forwarding nodes' devices.
+   * \param probe The probe.
+   * \param device The device whose DataRate times the transmission.
+   * \param p The packet.
+   */
+  static void Depart (HopLatencyProbe *probe, NetDevice *device, Ptr<const Packet> p);
+  /** Connect to MacRx of term_3's devices. */
+  void Deliver (Ptr<const Packet> p);
+
+  void PrintReport (std::ostream &os) const;
+
+private:
+  uint32_t                      m_sampleEvery;
+  uint64_t                      m_seen;
+  uint64_t                      m_delivered;
+  std::vector<LatencyHistogram> m_queueing;
+  std::vector<LatencyHistogram> m_transmission;
+  LatencyHistogram              m_total;
+};
+
+HopLatencyProbe::HopLatencyProbe (uint32_t sampleEvery)
+  : m_sampleEvery (sampleEvery),
+    m_seen (0),
+    m_delivered (0),
+    m_queueing (HopTimestampTag::MAX_HOPS),
+    m_transmission (HopTimestampTag::MAX_HOPS)
+{
+}
+
+void
+HopLatencyProbe::Stamp (Ptr<const Packet> p)
+{
+  if (m_seen++ % m_sampleEvery != 0)
+    {
+      return;
+    }
+  HopTimestampTag tag;
+  tag.Stamp ();
+  p->AddPacketTag (tag);
+}
+
+void
+HopLatencyProbe::Arrive (Ptr<const Packet> p)
+{
+  HopTimestampTag tag;
+  if (!p->PeekPacketTag (tag))
+    {
+      return;
+    }
+  tag.Arrive ();
+  // PhyRxEnd hands out the packet passed up to IP, so the tag goes on with it.
+  ConstCast<Packet> (p)->ReplacePacketTag (tag);
+}
+
+/* static */
+void
+HopLatencyProbe::Depart (HopLatencyProbe *probe, NetDevice *device, Ptr<const Packet> p)
+{
+  HopTimestampTag tag;
+  if (!p->PeekPacketTag (tag))
+    {
+      return;
+    }
+  DataRateValue rate;
+  device->GetAttribute ("DataRate", rate);
+  tag.Depart (rate.Get ().CalculateBytesTxTime (p->GetSize ()));
+  // PhyTxBegin runs before the channel copies the packet, so the copy carries the tag.
+  ConstCast<Packet> (p)->ReplacePacketTag (tag);
+}
+
+void
+HopLatencyProbe::Deliver (Ptr<const Packet> p)
+{
+  HopTimestampTag tag;
+  if (!p->PeekPacketTag (tag))
+    {
+      return;
+    }
+  ++m_delivered;
+  for (uint32_t h = 0; h < tag.GetHops (); ++h)
+    {
+      m_queueing[h].Record (uint64_t (tag.Get (h, HopTimestampTag::DEPART) - tag.Get (h, HopTimestampTag::ARRIVE)));
+      m_transmission[h].Record (uint64_t (tag.Get (h, HopTimestampTag::SENT) - tag.Get (h, HopTimestampTag::DEPART)));
+    }
+  m_total.Record (static_cast<uint64_t> (Simulator::Now ().GetNanoSeconds () - tag.GetOrigin ()));
+}
+
+void
+HopLatencyProbe::PrintReport (std::ostream &os) const
+{
+  os << "hops: sampled 1/" << m_sampleEvery << " delivered=" << m_delivered << std::endl;
+  for (uint32_t h = 0; h < HopTimestampTag::MAX_HOPS && m_queueing[h].GetCount (); ++h)
+    {
+      // Hop h is term_h on a single chain.
+      std::string hop = "hop " + std::to_string (h);
+      m_queueing[h].PrintSummary (os, hop + " queueing");
+      m_transmission[h].PrintSummary (os, hop + " transmission");
+    }
+  m_total.PrintSummary (os, "term_0 to term_3");
+}
+
+/**
+ * Sender-side delay: time from MyApp's Send to the transmission of the
+ * data on term_0's first device, read from the SendTimeTag of the oldest
+ * payload in each segment.  First transmissions and retransmissions (by
+ * the "retx" capture filter) go to separate histograms, splitting the
+ * time data waits in the TCP send buffer from the network latency.
+ */
+class SendBufferProbe : public SimpleRefCount<SendBufferProbe>
+{
+public:
+  SendBufferProbe ();
+
+  /** Connect to PhyTxBegin of term_0's first device. */
+  void Transmit (Ptr<const Packet> p);
+
+  void PrintReport (std::ostream &os) const;
+
+private:
+  CaptureFilter    m_retx;
+  LatencyHistogram m_first;
+  LatencyHistogram m_retransmitted;
+};
+
+SendBufferProbe::SendBufferProbe ()
+  : m_retx (CaptureFilter::Compile ("retx"))
+{
+}
+
+void
+SendBufferProbe::Transmit (Ptr<const Packet> p)
+{
+  // Run the filter on every frame so it sees each flow's highest sequence.
+  bool retx = m_retx.Matches (p);
+  int64_t oldest = INT64_MAX;
+  ByteTagIterator it = p->GetByteTagIterator ();
+  while (it.HasNext ())
+    {
+      ByteTagIterator::Item item = it.Next ();
+      if (item.GetTypeId () == SendTimeTag::GetTypeId ())
+        {
+          SendTimeTag tag;
+          item.GetTag (tag);
+          oldest = std::min (oldest, tag.GetSendTime ().GetNanoSeconds ());
+        }
+    }
+  if (oldest == INT64_MAX)
+    {
+      return;
+    }
+  uint64_t delay = static_cast<uint64_t> (std::max<int64_t> (Simulator::Now ().GetNanoSeconds () - oldest, 0));
+  (retx ? m_retransmitted : m_first).Record (delay);
+}
+
+void
+SendBufferProbe::PrintReport (std::ostream &os) const
+{
+  m_first.PrintSummary (os, "send buffer (first transmission)");
+  m_retransmitted.PrintSummary (os, "send buffer (retransmission)");
+}
+
+/**
+ * Per-interval limiting factor of one bulk flow.  At the end of every
+ * interval it reads the sender's state (cwnd, bytes in flight and the
+ * peer's receive window from their traces, unsent bytes from the send
+ * buffer) and the busiest forward link's utilization over the interval,
+ * and labels the interval with the first that applies:
+ *   link  the busiest link was transmitting for at least linkBusy of it;
+ *   app   less than a segment is waiting in the send buffer;
+ *   rwnd  the receive window is the smaller window and is full;
+ *   cwnd  the congestion window is full;
+ *   other none of these, typically loss recovery or a timeout.
+ * A window counts as full when less than a segment of it is unused.
+ */
+class LimitClassifier : public SimpleRefCount<LimitClassifier>
+{
+public:
+  /**
+   * \param socket The sender's socket.
+   * \param links Forward-direction devices whose utilization is checked.
+   * \param interval Sampling interval.
+   * \param linkBusy Utilization from which an interval is link-limited.
+   * \param stream Receives one line per interval.
+   */
+  LimitClassifier (Ptr<Socket> socket, std::vector<Ptr<NetDevice> > links, Time interval,
+                   double linkBusy, Ptr<OutputStreamWrapper> stream);
+
+  void Start (void);
+  void PrintReport (std::ostream &os) const;
+
+private:
+  enum Limit
+  {
+    LINK,
+    APP,
+    RWND,
+    CWND,
+    OTHER,
+    N_LIMITS
+  };
+  static const char *const NAMES[N_LIMITS];
+
+  /** PhyTxEnd of forward link number link. */
+  static void Transmit (LimitClassifier *classifier, uint32_t link, Ptr<const Packet> p);
+
+  void CwndChange (uint32_t oldValue, uint32_t newValue);
+  void InFlightChange (uint32_t oldValue, uint32_t newValue);
+  void RwndChange (uint32_t oldValue, uint32_t newValue);
+  void Sample (void);
+
+  Ptr<Socket>                   m_socket;
+  std::vector<Ptr<NetDevice> >  m_links;
+  std::vector<uint64_t>         m_linkBytes;  //!< per link, this interval
+  Time                          m_interval;
+  double                        m_linkBusy;
+  Ptr<OutputStreamWrapper>      m_stream;
+  uint32_t                      m_cwnd;
+  uint32_t                      m_inFlight;
+  uint32_t                      m_rwnd;
+  uint64_t                      m_counts[N_LIMITS];
+};
+
+const char *const LimitClassifier::NAMES[LimitClassifier::N_LIMITS] = { "link", "app", "rwnd", "cwnd", "other" };
+
+LimitClassifier::LimitClassifier (Ptr<Socket> socket, std::vector<Ptr<NetDevice> > links, Time interval,
+                                  double linkBusy, Ptr<OutputStreamWrapper> stream)
+  : m_socket (socket),
+    m_links (links),
+    m_linkBytes (links.size (), 0),
+    m_interval (interval),
+    m_linkBusy (linkBusy),
+    m_stream (stream),
+    m_cwnd (0),
+    m_inFlight (0),
+    m_rwnd (UINT32_MAX)
+{
+  std::fill (m_counts, m_counts + N_LIMITS, 0);
+  socket->TraceConnectWithoutContext ("CongestionWindow", MakeCallback (&LimitClassifier::CwndChange, this));
+  socket->TraceConnectWithoutContext ("BytesInFlight", MakeCallback (&LimitClassifier::InFlightChange, this));
+  socket->TraceConnectWithoutContext ("RWND", MakeCallback (&LimitClassifier::RwndChange, this));
+  for (uint32_t i = 0; i < links.size (); ++i)
+    {
+      links[i]->TraceConnectWithoutContext ("PhyTxEnd", MakeBoundCallback (&LimitClassifier::Transmit, this, i));
+    }
+  *m_stream->GetStream () << "# time\tlimit\tcwnd\tinFlight\trwnd\tunsent\tutilization" << std::endl;
+}
+
+void
+LimitClassifier::Start (void)
+{
+  ScheduleMember (m_interval, &LimitClassifier::Sample, this);
+}
+
+void
+LimitClassifier::CwndChange (uint32_t oldValue, uint32_t newValue)
+{
+  m_cwnd = newValue;
+}
+
+void
+LimitClassifier::InFlightChange (uint32_t oldValue, uint32_t newValue)
+{
+  m_inFlight = newValue;
+}
+
+void
+LimitClassifier::RwndChange (uint32_t oldValue, uint32_t newValue)
+{
+  m_rwnd = newValue;
+}
+
+/* static */
+void
+LimitClassifier::Transmit (LimitClassifier *classifier, uint32_t link, Ptr<const Packet> p)
+{
+  classifier->m_linkBytes[link] += p->GetSize ();
+}
+
+void
+LimitClassifier::Sample (void)
+{
+  double utilization = 0;
+  for (uint32_t i = 0; i < m_links.size (); ++i)
+    {
+      DataRateValue rate;
+      m_links[i]->GetAttribute ("DataRate", rate);
+      utilization = std::max (utilization, m_linkBytes[i] * 8.0 / (rate.Get ().GetBitRate () * m_interval.GetSeconds ()));
+      m_linkBytes[i] = 0;
+    }
+  UintegerValue sndBuf;
+  UintegerValue segment;
+  m_socket->GetAttribute ("SndBufSize", sndBuf);
+  m_socket->GetAttribute ("SegmentSize", segment);
+  uint64_t buffered = sndBuf.Get () - std::min<uint64_t> (m_socket->GetTxAvailable (), sndBuf.Get ());
+  uint64_t unsent = buffered - std::min<uint64_t> (m_inFlight, buffered);
+  uint64_t mss = segment.Get ();
+
+  Limit limit;
+  if (utilization >= m_linkBusy)
+    {
+      limit = LINK;
+    }
+  else if (unsent < mss)
+    {
+      limit = APP;
+    }
+  else if (m_rwnd <= m_cwnd && m_inFlight + mss > m_rwnd)
+    {
+      limit = RWND;
+    }
+  else if (m_inFlight + mss > m_cwnd)
+    {
+      limit = CWND;
+    }
+  else
+    {
+      limit = OTHER;
+    }
+  ++m_counts[limit];
+  *m_stream->GetStream () << Simulator::Now ().GetSeconds () << "\t" << NAMES[limit]
+                          << "\t" << m_cwnd << "\t" << m_inFlight << "\t" << m_rwnd
+                          << "\t" << unsent << "\t" << utilization << "\n";
+  ScheduleMember (m_interval, &LimitClassifier::Sample, this);
+}
+
+void
+LimitClassifier::PrintReport (std::ostream &os) const
+{
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < N_LIMITS; ++i)
+    {
+      total += m_counts[i];
+    }
+  os << "limits: intervals=" << total;
+  for (uint32_t i = 0; i < N_LIMITS; ++i)
+    {
+      os << " " << NAMES[i] << "=" << (total ? 100.0 * m_counts[i] / total : 0) << "%";
+    }
+  os << " (sixth.limits)" << std::endl;
+}
+
+/**
+ * Consistent hash-based flow sampling for per-flow traces.  A flow is
+ * sampled when the hash of its canonical five-tuple falls below
+ * fraction * 2^64, so the decision is the same in both directions, on every
+ * device and in every run.  Sampled flows write cwnd, RTT and drop records;
+ * every flow still feeds the aggregate counters, so trace output tracks
+ * the number of sampled flows rather than the flow count.
+ */
+class FlowTraceSampler : public SimpleRefCount<FlowTraceSampler>
+{
+public:
+  /**
+   * \param fraction Share of flows to trace in full, in [0, 1].
+   * \param cwnd Receives "time flow oldCwnd newCwnd" lines.
+   * \param rtt Receives "time flow rttNs" lines.
+   * \param drops Receives "time flow seq" lines.
+   */
+  FlowTraceSampler (double fraction, Ptr<OutputStreamWrapper> cwnd,
+                    Ptr<OutputStreamWrapper> rtt, Ptr<OutputStreamWrapper> drops);
+
+  /** Trace \p socket; the sampling decision is made once it is connected. */
+  void Attach (Ptr<Socket> socket);
+  /**
+   * Trace the far end of a flow whose initiator went through Attach, such
+   * as the accepted socket of a request/response connection.  It shares
+   * the flow's id but is not counted as another flow.
+   */
+  void AttachPeer (Ptr<Socket> socket);
+  /** Connect to PhyRxDrop and MacTxDrop of the chain devices. */
+  void Drop (Ptr<const Packet> p);
+  /**
+   * Connect to the drop traces of the root queue discs.  Their items carry
+   * no link or IPv4 header, so both are rebuilt before decoding.
+   */
+  void QueueDiscDrop (Ptr<const QueueDiscItem> item, const char *reason);
+
+  void PrintReport (std::ostream &os) const;
+
+private:
+  enum Decision { UNRESOLVED, SAMPLED, UNSAMPLED };
+
+  struct Flow : public SimpleRefCount<Flow>
+  {
+    FlowTraceSampler *sampler;
+    Socket           *socket;  //!< not a Ptr: the socket owns this record through its traces
+    Decision          decision;
+    uint32_t          id;
+    bool              counted;  //!< false for a peer end, which does not add to the flow counts
+  };
+
+  void Trace (Ptr<Socket> socket, bool counted);
+
+  static uint64_t Hash (uint32_t a, uint16_t aPort, uint32_t b, uint16_t bPort);
+  bool IsSampled (uint64_t hash) const;
+  static bool Resolve (Flow &flow);
+  static void CwndChanged (Ptr<Flow> flow, uint32_t oldCwnd, uint32_t newCwnd);
+  static void RttChanged (Ptr<Flow> flow, Time oldRtt, Time newRtt);
+
+  uint64_t                 m_threshold;
+  Ptr<OutputStreamWrapper> m_cwndStream;
+  Ptr<OutputStreamWrapper> m_rttStream;
+  Ptr<OutputStreamWrapper> m_dropStream;
+  uint64_t                 m_flows;
+  uint64_t                 m_sampled;
+  uint64_t                 m_cwndReductions;
+  uint64_t                 m_drops;
+  uint64_t                 m_sampledDrops;
+  LatencyHistogram         m_rtt;  //!< smoothed RTT samples of all flows
+};
+
+FlowTraceSampler::FlowTraceSampler (double fraction, Ptr<OutputStreamWrapper> cwnd,
+                                    Ptr<OutputStreamWrapper> rtt, Ptr<OutputStreamWrapper> drops)
+  : m_threshold (fraction >= 1 ? UINT64_MAX : static_cast<uint64_t> (std::max (fraction, 0.0) * 18446744073709551616.0)),
+    m_cwndStream (cwnd),
+    m_rttStream (rtt),
+    m_dropStream (drops),
+    m_flows (0),
+    m_sampled (0),
+    m_cwndReductions (0),
+    m_drops (0),
+    m_sampledDrops (0)
+{
+}
+
+uint64_t
+FlowTraceSampler::Hash (uint32_t a, uint16_t aPort, uint32_t b, uint16_t bPort)
+{
+  uint64_t x = (uint64_t (a) << 16) | aPort;
+  uint64_t y = (uint64_t (b) << 16) | bPort;
+  if (x > y)
+    {
+      std::swap (x, y);
+    }
+  uint64_t h = x * 0x9e3779b97f4a7c15ULL ^ y;
+  // MurmurHash3 finalizer.
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+bool
+FlowTraceSampler::IsSampled (uint64_t hash) const
+{
+  return m_threshold == UINT64_MAX || hash < m_threshold;
+}
+
+void
+FlowTraceSampler::Attach (Ptr<Socket> socket)
+{
+  Trace (socket, true);
+}
+
+void
+FlowTraceSampler::AttachPeer (Ptr<Socket> socket)
+{
+  Trace (socket, false);
+}
+
+void
+FlowTraceSampler::Trace (Ptr<Socket> socket, bool counted)
+{
+  Ptr<Flow> flow = Create<Flow> ();
+  flow->sampler = this;
+  flow->socket = PeekPointer (socket);
+  flow->decision = UNRESOLVED;
+  flow->id = 0;
+  flow->counted = counted;
+  if (counted)
+    {
+      ++m_flows;
+    }
+  Resolve (*flow);
+  socket->TraceConnectWithoutContext ("CongestionWindow", MakeBoundCallback (&FlowTraceSampler::CwndChanged, flow));
+  socket->TraceConnectWithoutContext ("RTT", MakeBoundCallback (&FlowTraceSampler::RttChanged, flow));
+}
+
+bool
+FlowTraceSampler::Resolve (Flow &flow)
+{
+  if (flow.decision != UNRESOLVED)
+    {
+      return flow.decision == SAMPLED;
+    }
+  Address local;
+  Address peer;
+  if (flow.socket->GetSockName (local) != 0 || flow.socket->GetPeerName (peer) != 0)
+    {
+      return false;
+    }
+  InetSocketAddress l = InetSocketAddress::ConvertFrom (local);
+  InetSocketAddress r = InetSocketAddress::ConvertFrom (peer);
+  uint64_t hash = Hash (l.GetIpv4 ().Get (), l.GetPort (), r.GetIpv4 ().Get (), r.GetPort ());
+  flow.id = static_cast<uint32_t> (hash >> 32);
+  flow.decision = flow.sampler->IsSampled (hash) ? SAMPLED : UNSAMPLED;
+  if (flow.decision == SAMPLED && flow.counted)
+    {
+      ++flow.sampler->m_sampled;
+    }
+  return flow.decision == SAMPLED;
+}
+
+void
+FlowTraceSampler::CwndChanged (Ptr<Flow> flow, uint32_t oldCwnd, uint32_t newCwnd)
+{
+  FlowTraceSampler *sampler = flow->sampler;
+  if (newCwnd < oldCwnd)
+    {
+      ++sampler->m_cwndReductions;
+    }
+  if (Resolve (*flow))
+    {
+      *sampler->m_cwndStream->GetStream () << Simulator::Now ().GetSeconds () << "\t" << flow->id
+                                           << "\t" << oldCwnd << "\t" << newCwnd << "\n";
+    }
+}
+
+void
+FlowTraceSampler::RttChanged (Ptr<Flow> flow, Time oldRtt, Time newRtt)
+{
+  FlowTraceSampler *sampler = flow->sampler;
+  sampler->m_rtt.Record (newRtt);
+  if (Resolve (*flow))
+    {
+      *sampler->m_rttStream->GetStream () << Simulator::Now ().GetSeconds () << "\t" << flow->id
+                                          << "\t" << newRtt.GetNanoSeconds () << "\n";
+    }
+}
+
+void
+FlowTraceSampler::Drop (Ptr<const Packet> p)
+{
+  CaptureFilter::Fields f;
+  if (!CaptureFilter::Decode (p, f) || !f.tcp)
+    {
+      return;
+    }
+  ++m_drops;
+  uint64_t hash = Hash (f.src, f.sport, f.dst, f.dport);
+  if (IsSampled (hash))
+    {
+      ++m_sampledDrops;
+      *m_dropStream->GetStream () << Simulator::Now ().GetSeconds () << "\t" << static_cast<uint32_t> (hash >> 32)
+                                  << "\t" << f.seq << "\n";
+    }
+}
+
+void
+FlowTraceSampler::QueueDiscDrop (Ptr<const QueueDiscItem> item, const char *reason)
+{
+  Ptr<const Ipv4QueueDiscItem> ipItem = DynamicCast<const Ipv4QueueDiscItem> (item);
+  if (!ipItem)
+    {
+      return;
+    }
+  Ptr<Packet> frame = ipItem->GetPacket ()->Copy ();
+  frame->AddHeader (ipItem->GetHeader ());
+  PppHeader ppp;
+  ppp.SetProtocol (0x0021);
+  frame->AddHeader (ppp);
+  Drop (frame);
+}
+
+void
+FlowTraceSampler::PrintReport (std::ostream &os) const
+{
+  os << "trace: flows=" << m_flows << " sampled=" << m_sampled
+     << " cwndReductions=" << m_cwndReductions
+     << " drops=" << m_drops << " sampledDrops=" << m_sampledDrops << std::endl;
+  m_rtt.PrintSummary (os, "rtt (all flows)");
+}
+
+static void
+CwndChange (Ptr<OutputStreamWrapper> stream, uint32_t oldCwnd, uint32_t newCwnd)
+{
+  NS_LOG_UNCOND (Simulator::Now ().GetSeconds () << "\t" << newCwnd);
+  *stream->GetStream () << Simulator::Now ().GetSeconds () << "\t" << oldCwnd << "\t" << newCwnd << std::endl;
+}
+
+/**
+ * Buffered text writer for the cwnd trace.  Records are formatted with
+ * std::to_chars into a reusable buffer and handed to the stream in large
+ * chunks, so a cwnd change costs a few integer conversions instead of an
+ * iostream double format and a std::endl flush.  The time column is integer
+ * nanoseconds; gnu_plot_file rescales it through its ts factor.
+ *
+ * In binary mode each record is 16 bytes in host byte order: int64 time in
+ * nanoseconds, uint32 old cwnd, uint32 new cwnd.  tcpchain-analyze reads
+ * this format.
+ */
+class CwndTraceWriter : public SimpleRefCount<CwndTraceWriter>
+{
+public:
+  CwndTraceWriter (Ptr<OutputStreamWrapper> stream, bool binary = false, std::size_t bufferSize = 1 << 16);
+  ~CwndTraceWriter ();
+
+  void Record (int64_t timeNs, uint32_t oldCwnd, uint32_t newCwnd);
+  void Flush (void);
+
+private:
+  static constexpr std::size_t MAX_RECORD = 64;  //!< upper bound on one formatted line
+
+  Ptr<OutputStreamWrapper> m_stream;
+  bool                     m_binary;
+  std::vector<char>        m_buffer;
+  std::size_t              m_used;
+};
+
+CwndTraceWriter::CwndTraceWriter (Ptr<OutputStreamWrapper> stream, bool binary, std::size_t bufferSize)
+  : m_stream (stream),
+    m_binary (binary),
+    m_buffer (std::max (bufferSize, MAX_RECORD)),
+    m_used (0)
+{
+}
+
+CwndTraceWriter::~CwndTraceWriter ()
+{
+  Flush ();
+}
+
+void
+CwndTraceWriter::Record (int64_t timeNs, uint32_t oldCwnd, uint32_t newCwnd)
+{
+  if (m_used + MAX_RECORD > m_buffer.size ())
+    {
+      Flush ();
+    }
+  char *p = m_buffer.data () + m_used;
+  if (m_binary)
+    {
+      std::memcpy (p, &timeNs, sizeof (timeNs));
+      std::memcpy (p + 8, &oldCwnd, sizeof (oldCwnd));
+      std::memcpy (p + 12, &newCwnd, sizeof (newCwnd));
+      m_used += 16;
+      return;
+    }
+  char *end = m_buffer.data () + m_buffer.size ();
+  p = std::to_chars (p, end, timeNs).ptr;
+  *p++ = '\t';
+  p = std::to_chars (p, end, oldCwnd).ptr;
+  *p++ = '\t';
+  p = std::to_chars (p, end, newCwnd).ptr;
+  *p++ = '\n';
+  m_used = p - m_buffer.data ();
+}
+
+void
+CwndTraceWriter::Flush (void)
+{
+  if (m_used > 0)
+    {
+      m_stream->GetStream ()->write (m_buffer.data (), m_used);
+      m_stream->GetStream ()->flush ();
+      m_used = 0;
+    }
+}
+
+static void
+CwndChangeNs (Ptr<CwndTraceWriter> writer, uint32_t oldCwnd, uint32_t newCwnd)
+{
+  writer->Record (Simulator::Now ().GetNanoSeconds (), oldCwnd, newCwnd);
+}
+
+/**
+ * Parse a --packetSizes value.
+ * \param spec "fixed", "imix" or the path of an empirical CDF file.
+ * \param fixedSize The size used for "fixed".
+ * \return The distribution.
+ */
+static Ptr<PacketSizeDistribution>
+ParseSizeDistribution (std::string spec, uint32_t fixedSize)
+{
+  if (spec == "fixed")
+    {
+      return Create<PacketSizeDistribution> (std::vector<uint32_t> {fixedSize}, std::vector<double> {1});
+    }
+  if (spec == "imix")
+    {
+      return PacketSizeDistribution::Imix ();
+    }
+  return PacketSizeDistribution::FromCdfFile (spec);
+}
+
+/**
+ * \return Resident set size of this process in bytes, or 0 where
+ *         /proc/self/statm is not available.
+ */
+static uint64_t
+GetRssBytes (void)
+{
+  std::ifstream statm ("/proc/self/statm");
+  uint64_t size = 0;
+  uint64_t resident = 0;
+  if (!(statm >> size >> resident))
+    {
+      return 0;
+    }
+  return resident * sysconf (_SC_PAGESIZE);
+}
+
+/**
+ * Size-class pool allocator behind the global operator new, for the small
+ * objects a run allocates on every send, ACK and forward (Packet, header
+ * and tag lists, events, callbacks).  Requests up to MAX_BYTES are rounded
+ * to a multiple of CLASS_BYTES and served from a free list or by bumping a
+ * per-class slab; each class owns a fixed slice of one reserved mapping,
+ * so operator delete finds the class from the address alone.  Larger
+ * requests, requests made before PoolEnable and those that overflow a
+ * slab go to malloc.  The free lists and slabs are not locked, so pooling
+ * is refused with --emulate, whose FdNetDevice reader threads allocate off
+ * the simulator thread.
+ *
+ * Enabled at run time with --poolAlloc; building with
+ * -DTCPCHAIN_SYSTEM_ALLOC leaves operator new alone.  Whenever operator new
+ * is replaced, allocations are counted, pooled or not, and --runStats
+ * prints the counts.  The counters are relaxed atomics since any thread may
+ * allocate.
+ */
+struct PoolAllocator
+{
+  static constexpr std::size_t CLASS_BYTES = 16;
+  static constexpr std::size_t N_CLASSES = 16;
+  static constexpr std::size_t MAX_BYTES = CLASS_BYTES * N_CLASSES;
+
+  bool        enabled;
+  char       *base;
+  std::size_t slabBytes;                 //!< reserved bytes per class
+  char       *bump[N_CLASSES];           //!< next never-used block of each class
+  void       *freeList[N_CLASSES];
+  std::atomic<uint64_t> allocs[N_CLASSES + 1];  //!< per class; the last entry counts malloc
+  std::atomic<uint64_t> frees[N_CLASSES + 1];
+};
+
+// Zero-initialized before any constructor runs, so operator new may use it at once.
+static PoolAllocator g_pool;
+
+static inline void
+PoolCount (std::atomic<uint64_t> &counter)
+{
+  counter.fetch_add (1, std::memory_order_relaxed);
+}
+
+static inline uint64_t
+PoolLoad (const std::atomic<uint64_t> &counter)
+{
+  return counter.load (std::memory_order_relaxed);
+}
+
+static inline void *
+PoolAllocate (std::size_t size)
+{
+  if (size <= PoolAllocator::MAX_BYTES)
+    {
+      std::size_t c = size ? (size - 1) / PoolAllocator::CLASS_BYTES : 0;
+      if (g_pool.enabled)
+        {
+          void *p = g_pool.freeList[c];
+          if (p)
+            {
+              g_pool.freeList[c] = *static_cast<void **> (p);
+              PoolCount (g_pool.allocs[c]);
+              return p;
+            }
+          char *slabEnd = g_pool.base + (c + 1) * g_pool.slabBytes;
+          std::size_t blockBytes = (c + 1) * PoolAllocator::CLASS_BYTES;
+          if (g_pool.bump[c] + blockBytes <= slabEnd)
+            {
+              p = g_pool.bump[c];
+              g_pool.bump[c] += blockBytes;
+              PoolCount (g_pool.allocs[c]);
+              return p;
+            }
+        }
+    }
+  PoolCount (g_pool.allocs[PoolAllocator::N_CLASSES]);
+  return std::malloc (size ? size : 1);
+}
+
+static inline void
+PoolFree (void *p)
+{
+  char *c = static_cast<char *> (p);
+  if (g_pool.base && c >= g_pool.base && c < g_pool.base + PoolAllocator::N_CLASSES * g_pool.slabBytes)
+    {
+      std::size_t cls = (c - g_pool.base) / g_pool.slabBytes;
+      *static_cast<void **> (p) = g_pool.freeList[cls];
+      g_pool.freeList[cls] = p;
+      PoolCount (g_pool.frees[cls]);
+      return;
+    }
+  if (p)
+    {
+      PoolCount (g_pool.frees[PoolAllocator::N_CLASSES]);
+      std::free (p);
+    }
+}
+
+/**
+ * Reserve \p reserveMb of address space for the slabs and start pooling.
+ * Pages are only committed as the slabs grow.
+ */
+static void
+PoolEnable (uint64_t reserveMb)
+{
+#ifdef TCPCHAIN_SYSTEM_ALLOC
+  NS_FATAL_ERROR ("--poolAlloc is not available in a -DTCPCHAIN_SYSTEM_ALLOC build");
+#else
+  std::size_t bytes = static_cast<std::size_t> (reserveMb) << 20;
+  void *base = mmap (0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  NS_ABORT_MSG_IF (base == MAP_FAILED, "Cannot reserve " << reserveMb << " MB for the pool allocator");
+  g_pool.slabBytes = bytes / PoolAllocator::N_CLASSES / PoolAllocator::MAX_BYTES * PoolAllocator::MAX_BYTES;
+  g_pool.base = static_cast<char *> (base);
+  for (std::size_t c = 0; c < PoolAllocator::N_CLASSES; ++c)
+    {
+      g_pool.bump[c] = g_pool.base + c * g_pool.slabBytes;
+    }
+  g_pool.enabled = true;
+#endif
+}
+
+#ifndef TCPCHAIN_SYSTEM_ALLOC
+/** Print allocation counts and the footprint of the pool and the malloc heap. */
+static void
+PoolReport (std::ostream &os)
+{
+  uint64_t allocs = 0;
+  uint64_t frees = 0;
+  uint64_t liveBytes = 0;
+  uint64_t footprint = 0;
+  os << "alloc classes:";
+  for (std::size_t c = 0; c < PoolAllocator::N_CLASSES; ++c)
+    {
+      std::size_t blockBytes = (c + 1) * PoolAllocator::CLASS_BYTES;
+      allocs += PoolLoad (g_pool.allocs[c]);
+      frees += PoolLoad (g_pool.frees[c]);
+      liveBytes += (PoolLoad (g_pool.allocs[c]) - PoolLoad (g_pool.frees[c])) * blockBytes;
+      if (g_pool.base)
+        {
+          footprint += g_pool.bump[c] - (g_pool.base + c * g_pool.slabBytes);
+        }
+      os << " " << blockBytes << ":" << PoolLoad (g_pool.allocs[c]);
+    }
+  os << std::endl;
+  os << "alloc: pool=" << (g_pool.enabled ? "on" : "off")
+     << " pooled=" << allocs << " pooledFrees=" << frees
+     << " malloc=" << PoolLoad (g_pool.allocs[PoolAllocator::N_CLASSES])
+     << " mallocFrees=" << PoolLoad (g_pool.frees[PoolAllocator::N_CLASSES])
+     << " poolLiveKiB=" << liveBytes / 1024 << " poolFootprintKiB=" << footprint / 1024;
+#if defined (__GLIBC__)
+#if __GLIBC_PREREQ (2, 33)
+  // Heap fragmentation: bytes malloc holds from the system against bytes in use.
+  struct mallinfo2 heap = mallinfo2 ();
+  os << " heapInUseKiB=" << heap.uordblks / 1024 << " heapArenaKiB=" << (heap.arena + heap.hblkhd) / 1024;
+#endif
+#endif
+  os << " rssKiB=" << GetRssBytes () / 1024 << std::endl;
+}
+
+void *
+operator new (std::size_t size)
+{
+  void *p = PoolAllocate (size);
+  if (!p)
+    {
+      throw std::bad_alloc ();
+    }
+  return p;
+}
+
+void *
+operator new[] (std::size_t size)
+{
+  return operator new (size);
+}
+
+void *
+operator new (std::size_t size, const std::nothrow_t &) noexcept
+{
+  return PoolAllocate (size);
+}
+
+void *
+operator new[] (std::size_t size, const std::nothrow_t &) noexcept
+{
+  return PoolAllocate (size);
+}
+
+void
+operator delete (void *p) noexcept
+{
+  PoolFree (p);
+}
+
+void
+operator delete[] (void *p) noexcept
+{
+  PoolFree (p);
+}
+
+void
+operator delete (void *p, std::size_t) noexcept
+{
+  PoolFree (p);
+}
+
+void
+operator delete[] (void *p, std::size_t) noexcept
+{
+  PoolFree (p);
+}
+
+void
+operator delete (void *p, const std::nothrow_t &) noexcept
+{
+  PoolFree (p);
+}
+
+void
+operator delete[] (void *p, const std::nothrow_t &) noexcept
+{
+  PoolFree (p);
+}
+#endif /* TCPCHAIN_SYSTEM_ALLOC */
+
+/**
+ * Hierarchical timing wheel: eight levels of 256 slots, one per byte of the
+ * 64-bit timestamp.  An event goes to the level of the highest byte in
+ * which its timestamp differs from the wheel's cursor, so Insert is O(1);
+ * when level 0 runs dry, the next occupied slot of the lowest level above
+ * it is cascaded down, which moves an event at most eight times.  A level-0
+ * slot holds a single timestamp and is sorted by uid only when it drains.
+ *
+ * PeekNext cascades too, moving the cursor up to the earliest event, so a
+ * peek followed by RemoveNext does the work once.  Events inserted behind
+ * the cursor (after a peek, before the current time catches up) are earlier
+ * than anything in the wheel and wait in a small binary heap that is
+ * drained first.
+ *
+ * It is not the default: in a synthetic TCP-like load (one send and one
+ * never-cancelled RTO per event, peek before every removal) it is about 1.2x
+ * slower than MapScheduler at 1,000 flows, even at 5,000 and 1.4x faster at
+ * 10,000, where the map's O(log n) starts to dominate.
+ *
+ * Simulator::Cancel never reaches a scheduler.  Remove, used by
+ * Simulator::Remove, only notes the uid; the entry is dropped when the
+ * wheel next meets it, without touching its (by then released) EventImpl.
+ */
+class TimerWheelScheduler : public Scheduler
+{
+public:
+  static TypeId GetTypeId (void);
+
+  TimerWheelScheduler ();
+  virtual ~TimerWheelScheduler ();
+
+  virtual void Insert (const Event &ev);
+  virtual bool IsEmpty (void) const;
+  virtual Event PeekNext (void) const;
+  virtual Event RemoveNext (void);
+  virtual void Remove (const Event &ev);
+
+private:
+  static constexpr uint32_t LEVELS = 8;
+  static constexpr uint32_t SLOT_BITS = 8;
+  static constexpr uint32_t SLOTS = 1 << SLOT_BITS;
+
+  struct Slot
+  {
+    std::vector<Event> events;
+    std::size_t        head;    //!< level 0: events before it have run
+    bool               sorted;  //!< level 0: events[head..] ascend by uid
+  };
+
+  static bool Before (const Event &a, const Event &b);
+  static bool After (const Event &a, const Event &b);
+  static uint32_t SlotOf (uint64_t ts, uint32_t level);
+
+  void Place (const Event &ev);
+  void Clear (uint32_t level, uint32_t slot);
+  bool IsRemoved (const Event &ev) const;
+  /** \return The first occupied slot of level at or after from, or SLOTS. */
+  uint32_t FindSlot (uint32_t level, uint32_t from) const;
+  /** Cascade until the earliest live event is at level 0. \return Its slot. */
+  uint32_t Advance (void);
+  /** Drop removed events from the top of m_early. \return Whether it holds a live one. */
+  bool PurgeEarly (void);
+  /** \return The earliest live event, cascading the wheel if needed. */
+  const Event &Front (void);
+
+  std::vector<Slot>            m_slots;  //!< LEVELS rows of SLOTS
+  uint64_t                     m_occupied[LEVELS][SLOTS / 64];
+  uint64_t                     m_cursor;
+  uint64_t                     m_size;   //!< live events
+  std::vector<Event>           m_early;  //!< heap of events before m_cursor
+  std::unordered_set<uint32_t> m_removed;
+};
+
+/* static */
+TypeId TimerWheelScheduler::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("TimerWheelScheduler")
+    .SetParent<Scheduler> ()
+    .SetGroupName ("Tutorial")
+    .AddConstructor<TimerWheelScheduler> ()
+    ;
+  return tid;
+}
+
+TimerWheelScheduler::TimerWheelScheduler ()
+  : m_slots (LEVELS * SLOTS, Slot {std::vector<Event> (), 0, true}),
+    m_cursor (0),
+    m_size (0)
+{
+  std::fill (&m_occupied[0][0], &m_occupied[0][0] + LEVELS * SLOTS / 64, 0);
+}
+
+TimerWheelScheduler::~TimerWheelScheduler ()
+{
+}
+
+/* static */
+bool
+TimerWheelScheduler::Before (const Event &a, const Event &b)
+{
+  return a.key.m_ts < b.key.m_ts
+         || (a.key.m_ts == b.key.m_ts && a.key.m_uid < b.key.m_uid);
+}
+
+/* static */
+bool
+TimerWheelScheduler::After (const Event &a, const Event &b)
+{
+  return Before (b, a);
+}
+
+/* static */
+uint32_t
+TimerWheelScheduler::SlotOf (uint64_t ts, uint32_t level)
+{
+  return (ts >> (level * SLOT_BITS)) & (SLOTS - 1);
+}
+
+void
+TimerWheelScheduler::Place (const Event &ev)
+{
+  uint64_t diff = ev.key.m_ts ^ m_cursor;
+  uint32_t level = diff ? (63 - __builtin_clzll (diff)) / SLOT_BITS : 0;
+  uint32_t slot = SlotOf (ev.key.m_ts, level);
+  Slot &s = m_slots[level * SLOTS + slot];
+  if (level == 0 && s.events.size () > s.head && ev.key.m_uid < s.events.back ().key.m_uid)
+    {
+      s.sorted = false;
+    }
+  s.events.push_back (ev);
+  m_occupied[level][slot / 64] |= uint64_t (1) << (slot % 64);
+}
+
+void
+TimerWheelScheduler::Clear (uint32_t level, uint32_t slot)
+{
+  Slot &s = m_slots[level * SLOTS + slot];
+  s.events.clear ();
+  s.head = 0;
+  s.sorted = true;
+  m_occupied[level][slot / 64] &= ~(uint64_t (1) << (slot % 64));
+}
+
+bool
+TimerWheelScheduler::IsRemoved (const Event &ev) const
+{
+  return !m_removed.empty () && m_removed.count (ev.key.m_uid);
+}
+
+uint32_t
+TimerWheelScheduler::FindSlot (uint32_t level, uint32_t from) const
+{
+  for (uint32_t word = from / 64; word < SLOTS / 64; ++word)
+    {
+      uint64_t bits = m_occupied[level][word];
+      if (word == from / 64)
+        {
+          bits &= ~uint64_t (0) << (from % 64);
+        }
+      if (bits)
+        {
+          return word * 64 + __builtin_ctzll (bits);
+        }
+    }
+  return SLOTS;
+}
+
+void
+TimerWheelScheduler::Insert (const Event &ev)
+{
+  if (ev.key.m_ts < m_cursor)
+    {
+      m_early.push_back (ev);
+      std::push_heap (m_early.begin (), m_early.end (), &TimerWheelScheduler::After);
+    }
+  else
+    {
+      Place (ev);
+    }
+  ++m_size;
+}
+
+bool
+TimerWheelScheduler::IsEmpty (void) const
+{
+  return m_size == 0;
+}
+
+uint32_t
+TimerWheelScheduler::Advance (void)
+{
+  for (;;)
+    {
+      uint32_t slot = FindSlot (0, SlotOf (m_cursor, 0));
+      if (slot < SLOTS)
+        {
+          Slot &s = m_slots[slot];
+          while (s.head < s.events.size () && IsRemoved (s.events[s.head]))
+            {
+              m_removed.erase (s.events[s.head++].key.m_uid);
+            }
+          if (!s.sorted)
+            {
+              std::sort (s.events.begin () + s.head, s.events.end (), &TimerWheelScheduler::Before);
+              s.sorted = true;
+              continue;
+            }
+          if (s.head < s.events.size ())
+            {
+              return slot;
+            }
+          Clear (0, slot);
+          continue;
+        }
+      uint32_t level = 1;
+      for (; level < LEVELS; ++level)
+        {
+          slot = FindSlot (level, SlotOf (m_cursor, level) + 1);
+          if (slot < SLOTS)
+            {
+              break;
+            }
+        }
+      NS_ASSERT_MSG (level < LEVELS, "TimerWheelScheduler ran out of events");
+      uint32_t shift = level * SLOT_BITS;
+      uint64_t high = level + 1 < LEVELS ? m_cursor >> (shift + SLOT_BITS) << (shift + SLOT_BITS) : 0;
+      m_cursor = high | (uint64_t (slot) << shift);
+      std::vector<Event> events;
+      events.swap (m_slots[level * SLOTS + slot].events);
+      Clear (level, slot);
+      for (const Event &ev : events)
+        {
+          if (IsRemoved (ev))
+            {
+              m_removed.erase (ev.key.m_uid);
+            }
+          else
+            {
+              Place (ev);
+            }
+        }
+      // Hand the storage back so the slot does not reallocate next time.
+      events.clear ();
+      m_slots[level * SLOTS + slot].events.swap (events);
+    }
+}
+
+bool
+TimerWheelScheduler::PurgeEarly (void)
+{
+  while (!m_early.empty () && IsRemoved (m_early.front ()))
+    {
+      m_removed.erase (m_early.front ().key.m_uid);
+      std::pop_heap (m_early.begin (), m_early.end (), &TimerWheelScheduler::After);
+      m_early.pop_back ();
+    }
+  return !m_early.empty ();
+}
+
+const Scheduler::Event &
+TimerWheelScheduler::Front (void)
+{
+  if (PurgeEarly ())
+    {
+      return m_early.front ();
+    }
+  uint32_t slot = Advance ();
+  Slot &s = m_slots[slot];
+  // Nothing in the wheel is earlier; later inserts before it go to m_early.
+  m_cursor = s.events[s.head].key.m_ts;
+  return s.events[s.head];
+}
+
+Scheduler::Event
+TimerWheelScheduler::PeekNext (void) const
+{
+  NS_ASSERT (!IsEmpty ());
+  // Cascading reorganizes the wheel without changing the set of events.
+  return const_cast<TimerWheelScheduler *> (this)->Front ();
+}
+
+Scheduler::Event
+TimerWheelScheduler::RemoveNext (void)
+{
+  NS_ASSERT (!IsEmpty ());
+  Event ev;
+  if (PurgeEarly ())
+    {
+      std::pop_heap (m_early.begin (), m_early.end (), &TimerWheelScheduler::After);
+      ev = m_early.back ();
+      m_early.pop_back ();
+    }
+  else
+    {
+      uint32_t slot = Advance ();
+      Slot &s = m_slots[slot];
+      ev = s.events[s.head++];
+      if (s.head == s.events.size ())
+        {
+          Clear (0, slot);
+        }
+      m_cursor = ev.key.m_ts;
+    }
+  --m_size;
+  return ev;
+}
+
+void
+TimerWheelScheduler::Remove (const Event &ev)
+{
+  m_removed.insert (ev.key.m_uid);
+  --m_size;
+}
+
+/**
+ * \param name map, heap, list, calendar or wheel.
+ * \return A factory for the named scheduler.
+ */
+static ObjectFactory
+SchedulerFactory (const std::string &name)
+{
+  ObjectFactory factory;
+  if (name == "map" || name == "heap" || name == "list" || name == "calendar")
+    {
+      std::string type = name;
+      type[0] = std::toupper (type[0]);
+      factory.SetTypeId ("ns3::" + type + "Scheduler");
+    }
+  else if (name == "wheel")
+    {
+      factory.SetTypeId (TimerWheelScheduler::GetTypeId ());
+    }
+  else
+    {
+      NS_FATAL_ERROR ("Unknown --scheduler " << name);
+    }
+  return factory;
+}
+
+/**
+ * Scheduler wrapper that counts the events it holds, for --soak.  Every
+ * call goes to an inner scheduler of the type named by its "Scheduler"
+ * attribute.  Cancelled events stay pending until their time comes, as in
+ * every scheduler, so they are counted too.
+ */
+class CountingScheduler : public Scheduler
+{
+public:
+  static TypeId GetTypeId (void);
+
+  CountingScheduler ();
+  virtual ~CountingScheduler ();
+
+  /** \return Events held by the scheduler of the running simulation. */
+  static uint64_t GetPending (void);
+
+  virtual void Insert (const Event &ev);
+  virtual bool IsEmpty (void) const;
+  virtual Event PeekNext (void) const;
+  virtual Event RemoveNext (void);
+  virtual void Remove (const Event &ev);
+
+private:
+  void SetInner (std::string type);
+  std::string GetInner (void) const;
+
+  static uint64_t m_pending;
+  Ptr<Scheduler>  m_inner;
+};
+
+uint64_t CountingScheduler::m_pending = 0;
+
+/* static */
+TypeId CountingScheduler::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("CountingScheduler")
+    .SetParent<Scheduler> ()
+    .SetGroupName ("Tutorial")
+    .AddConstructor<CountingScheduler> ()
+    .AddAttribute ("Scheduler",
+                   "Type of the scheduler that holds the events.",
+                   StringValue ("ns3::MapScheduler"),
+                   MakeStringAccessor (&CountingScheduler::SetInner,
+                                       &CountingScheduler::GetInner),
+                   MakeStringChecker ())
+    ;
+  return tid;
+}
+
+CountingScheduler::CountingScheduler ()
+{
+}
+
+CountingScheduler::~CountingScheduler ()
+{
+}
+
+/* static */
+uint64_t
+CountingScheduler::GetPending (void)
+{
+  return m_pending;
+}
+
+void
+CountingScheduler::SetInner (std::string type)
+{
+  NS_ABORT_MSG_IF (m_inner && !m_inner->IsEmpty (), "Cannot replace a scheduler that holds events");
+  ObjectFactory factory;
+  factory.SetTypeId (type);
+  m_inner = factory.Create<Scheduler> ();
+}
+
+std::string
+CountingScheduler::GetInner (void) const
+{
+  return m_inner ? m_inner->GetInstanceTypeId ().GetName () : "";
+}
+
+void
+CountingScheduler::Insert (const Event &ev)
+{
+  m_inner->Insert (ev);
+  ++m_pending;
+}
+
+bool
+CountingScheduler::IsEmpty (void) const
+{
+  return m_inner->IsEmpty ();
+}
+
+Scheduler::Event
+CountingScheduler::PeekNext (void) const
+{
+  return m_inner->PeekNext ();
+}
+
+Scheduler::Event
+CountingScheduler::RemoveNext (void)
+{
+  --m_pending;
+  return m_inner->RemoveNext ();
+}
+
+void
+CountingScheduler::Remove (const Event &ev)
+{
+  m_inner->Remove (ev);
+  --m_pending;
+}
+
+/**
+ * Install only what a node of the chain needs, instead of the full
+ * InternetStackHelper set (IPv4, IPv6, ICMP, UDP, TCP, ARP, packet sockets
+ * and traffic control).  Forwarding nodes get ARP, IPv4 and ICMP with the
+ * usual static + global routing; endpoints also get TCP.  The traffic-control
+ * layer is kept on both since Ipv4Interface sends through it, and ICMP since
+ * Ipv4L3Protocol::IpForward sends Time Exceeded through it unchecked.
+ * \param node The node.
+ * \param endpoint Whether TCP sockets are opened on the node.
+ */
+static void
+InstallLeanStack (Ptr<Node> node, bool endpoint)
+{
+  ObjectFactory factory;
+  factory.SetTypeId ("ns3::ArpL3Protocol");
+  node->AggregateObject (factory.Create<Object> ());
+  factory.SetTypeId ("ns3::Ipv4L3Protocol");
+  node->AggregateObject (factory.Create<Object> ());
+  // Registers itself with the IPv4 protocol aggregated above.
+  factory.SetTypeId ("ns3::Icmpv4L4Protocol");
+  node->AggregateObject (factory.Create<Object> ());
+
+  Ipv4StaticRoutingHelper staticRouting;
+  Ipv4GlobalRoutingHelper globalRouting;
+  Ipv4ListRoutingHelper listRouting;
+  listRouting.Add (staticRouting, 0);
+  listRouting.Add (globalRouting, -10);
+  node->GetObject<Ipv4> ()->SetRoutingProtocol (listRouting.Create (node));
+
+  factory.SetTypeId ("ns3::TrafficControlLayer");
+  node->AggregateObject (factory.Create<Object> ());
+  if (endpoint)
+    {
+      factory.SetTypeId ("ns3::TcpL4Protocol");
+      node->AggregateObject (factory.Create<Object> ());
+    }
+}
+
+/**
+ * Install the full or the lean stack on \p nodes and report the wall time
+ * and RSS growth per node.  Run with --stackBenchNodes=N to compare the two
+ * profiles without building the chain.
+ * \param nNodes Nodes to create.
+ * \param lean Use InstallLeanStack (forwarding profile) instead of InternetStackHelper.
+ */
+static void
+BenchmarkStackInstall (uint32_t nNodes, bool lean)
+{
+  uint64_t rssBefore = GetRssBytes ();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+
+  NodeContainer nodes;
+  nodes.Create (nNodes);
+  InternetStackHelper internetStackH;
+  for (uint32_t i = 0; i < nNodes; ++i)
+    {
+      if (lean)
+        {
+          InstallLeanStack (nodes.Get (i), false);
+        }
+      else
+        {
+          internetStackH.Install (nodes.Get (i));
+        }
+    }
+
+  double elapsedUs = std::chrono::duration<double, std::micro> (std::chrono::steady_clock::now () - start).count ();
+  uint64_t rssAfter = GetRssBytes ();
+  std::cout << "stack=" << (lean ? "lean" : "full") << " nodes=" << nNodes
+            << " setup=" << elapsedUs / 1e3 << "ms (" << elapsedUs / nNodes << "us/node)"
+            << " rss=+" << (rssAfter - rssBefore) / 1024 << "KiB ("
+            << static_cast<double> (rssAfter - rssBefore) / nNodes << "B/node)" << std::endl;
+}
+
+static void
+DctcpEstimate (Ptr<OutputStreamWrapper> stream, uint32_t bytesAcked, uint32_t bytesMarked, double alpha)
+{
+  *stream->GetStream () << Simulator::Now ().GetSeconds () << "\t" << bytesAcked << "\t" << bytesMarked << "\t" << alpha << std::endl;
+}
+
+/**
+ * Drop counts per device and time bin, kept in one preallocated array and
+ * written as a single matrix at the end of the run: one row per bin, one
+ * column per device, counting receive, queue disc and device queue drops.
+ * Replaces RxDrop and sixth.pcap when only the number, place and time of
+ * drops matter.
+ */
+class DropCounter : public SimpleRefCount<DropCounter>
+{
+public:
+  /**
+   * \param devices Column labels, one per device.
+   * \param bin Width of a time bin.
+   * \param duration Run length; later drops land in the last bin.
+   */
+  DropCounter (std::vector<std::string> devices, Time bin, Time duration);
+
+  void Drop (uint32_t device);
+  uint64_t GetTotal (void) const;
+  /** Write "time label..." then one "binStart count..." row per bin. */
+  void Write (std::ostream &os) const;
+
+private:
+  std::vector<std::string> m_devices;
+  int64_t                  m_binNs;
+  uint32_t                 m_bins;
+  std::vector<uint32_t>    m_counts;  //!< m_bins rows of m_devices.size () counts
+  uint64_t                 m_total;
+};
+
+DropCounter::DropCounter (std::vector<std::string> devices, Time bin, Time duration)
+  : m_devices (devices),
+    m_binNs (std::max<int64_t> (bin.GetNanoSeconds (), 1)),
+    m_bins (static_cast<uint32_t> ((duration.GetNanoSeconds () + m_binNs - 1) / m_binNs)),
+    m_total (0)
+{
+  m_bins = std::max<uint32_t> (m_bins, 1);
+  m_counts.assign (static_cast<std::size_t> (m_bins) * m_devices.size (), 0);
+}
+
+void
+DropCounter::Drop (uint32_t device)
+{
+  uint32_t bin = std::min<int64_t> (Simulator::Now ().GetNanoSeconds () / m_binNs, m_bins - 1);
+  ++m_counts[static_cast<std::size_t> (bin) * m_devices.size () + device];
+  ++m_total;
+}
+
+uint64_t
+DropCounter::GetTotal (void) const
+{
+  return m_total;
+}
+
+void
+DropCounter::Write (std::ostream &os) const
+{
+  os << "time";
+  for (const std::string &label : m_devices)
+    {
+      os << "\t" << label;
+    }
+  os << "\n";
+  for (uint32_t bin = 0; bin < m_bins; ++bin)
+    {
+      os << bin * m_binNs / 1e9;
+      for (std::size_t d = 0; d < m_devices.size (); ++d)
+        {
+          os << "\t" << m_counts[bin * m_devices.size () + d];
+        }
+      os << "\n";
+    }
+}
+
+static void
+CountDrop (Ptr<DropCounter> counter, uint32_t device, Ptr<const Packet> p)
+{
+  counter->Drop (device);
+}
+
+static void
+CountQueueDiscDrop (Ptr<DropCounter> counter, uint32_t device, Ptr<const QueueDiscItem> item, const char *reason)
+{
+  counter->Drop (device);
+}
+
+static void
+RxDrop (Ptr<PcapFileWrapper> file, Ptr<const Packet> p)
+{
+  NS_LOG_UNCOND ("RxDrop at " << Simulator::Now ().GetSeconds ());
+  file->Write (Simulator::Now (), p);
+}
+
+/**
+ * Warm-start branching: at the branch time the process forks one child per
+ * value of a single parameter.  Each child applies its value and simulates
+ * on from the shared state, writing into its own directory branch-<k>/;
+ * the parent waits for the children and ends the run there, so the
+ * top-level outputs hold the shared prefix only.
+ *
+ * The outputs are found as the regular files in the working directory the
+ * process has open for writing.  A child copies each one into its
+ * directory and moves the descriptor over to the copy, so the stream
+ * objects (sixth.cwnd, pcaps, ...) carry on unaware, together with any
+ * data still in their buffers.  Standard output goes to branch-<k>/stdout,
+ * and the child then works in branch-<k>/, so files first opened after the
+ * fork (sixth.drops) land there as well.  The parent writes the prefix's
+ * sixth.drops before it returns.
+ */
+class WarmStartBrancher : public SimpleRefCount<WarmStartBrancher>
+{
+public:
+  /**
+   * \param param Name of the parameter, for the report.
+   * \param values One branch per value.
+   * \param apply Sets the parameter to a value in a child.
+   */
+  WarmStartBrancher (std::string param, std::vector<std::string> values,
+                     Callback<void, std::string> apply);
+
+  /** Fork the branches; scheduled once, at the branch time. */
+  void Fork (void);
+  /** \return Whether this is the parent, which stopped at the branch time. */
+  bool IsParent (void) const;
+  /** Print the exit status of each branch. \return 0 if all succeeded. */
+  int PrintReport (std::ostream &os) const;
+
+private:
+  void RedirectOutputs (const std::string &dir) const;
+
+  std::string                 m_param;
+  std::vector<std::string>    m_values;
+  Callback<void, std::string> m_apply;
+  std::vector<int>            m_status;  //!< wait status per branch, in the parent
+  bool                        m_parent;
+};
+
+WarmStartBrancher::WarmStartBrancher (std::string param, std::vector<std::string> values,
+                                      Callback<void, std::string> apply)
+  : m_param (param),
+    m_values (values),
+    m_apply (apply),
+    m_parent (false)
+{
+}
+
+void
+WarmStartBrancher::Fork (void)
+{
+  // Unflushed standard output would be printed once per process.
+  std::cout.flush ();
+  std::vector<pid_t> children;
+  for (uint32_t k = 0; k < m_values.size (); ++k)
+    {
+      pid_t pid = fork ();
+      if (pid < 0)
+        {
+          NS_FATAL_ERROR ("fork failed for branch " << k << ": " << std::strerror (errno));
+        }
+      if (pid == 0)
+        {
+          std::string dir = "branch-" + std::to_string (k);
+          if (mkdir (dir.c_str (), 0755) < 0 && errno != EEXIST)
+            {
+              NS_FATAL_ERROR ("Cannot create " << dir << ": " << std::strerror (errno));
+            }
+          RedirectOutputs (dir);
+          // Outputs created after the fork (sixth.drops, reports) go there too.
+          if (chdir (dir.c_str ()) < 0)
+            {
+              NS_FATAL_ERROR ("Cannot enter " << dir << ": " << std::strerror (errno));
+            }
+          std::cout << "branch " << k << ": " << m_param << "=" << m_values[k]
+                    << " from " << Simulator::Now ().GetSeconds () << "s" << std::endl;
+          m_apply (m_values[k]);
+          return;
+        }
+      children.push_back (pid);
+    }
+  m_parent = true;
+  for (pid_t pid : children)
+    {
+      int status = 0;
+      waitpid (pid, &status, 0);
+      m_status.push_back (status);
+    }
+  Simulator::Stop ();
+}
+
+void
+WarmStartBrancher::RedirectOutputs (const std::string &dir) const
+{
+  char cwd[PATH_MAX];
+  if (!getcwd (cwd, sizeof (cwd)))
+    {
+      NS_FATAL_ERROR ("getcwd failed: " << std::strerror (errno));
+    }
+  std::string prefix = std::string (cwd) + "/";
+
+  std::vector<int> fds;
+  DIR *fdDir = opendir ("/proc/self/fd");
+  NS_ABORT_MSG_IF (!fdDir, "Branching needs /proc/self/fd");
+  for (struct dirent *entry = readdir (fdDir); entry; entry = readdir (fdDir))
+    {
+      if (std::isdigit (static_cast<unsigned char> (entry->d_name[0])))
+        {
+          fds.push_back (std::atoi (entry->d_name));
+        }
+    }
+  closedir (fdDir);
+
+  for (int fd : fds)
+    {
+      char target[PATH_MAX];
+      ssize_t length = readlink (("/proc/self/fd/" + std::to_string (fd)).c_str (), target, sizeof (target) - 1);
+      struct stat info;
+      int flags = fcntl (fd, F_GETFL);
+      if (fd <= STDERR_FILENO || length <= 0 || fstat (fd, &info) < 0 || !S_ISREG (info.st_mode)
+          || flags < 0 || (flags & O_ACCMODE) == O_RDONLY)
+        {
+          continue;
+        }
+      std::string path (target, length);
+      if (path.compare (0, prefix.size (), prefix) != 0
+          || path.find ('/', prefix.size ()) != std::string::npos)
+        {
+          continue;
+        }
+      std::string copyPath = dir + "/" + path.substr (prefix.size ());
+      int in = open (path.c_str (), O_RDONLY);
+      int out = open (copyPath.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (in < 0 || out < 0)
+        {
+          NS_FATAL_ERROR ("Cannot copy " << path << " to " << copyPath << ": " << std::strerror (errno));
+        }
+      char buffer[65536];
+      for (ssize_t n = read (in, buffer, sizeof (buffer)); n > 0; n = read (in, buffer, sizeof (buffer)))
+        {
+          NS_ABORT_MSG_IF (write (out, buffer, n) != n, "Short write to " << copyPath);
+        }
+      close (in);
+      lseek (out, lseek (fd, 0, SEEK_CUR), SEEK_SET);
+      dup2 (out, fd);
+      close (out);
+    }
+
+  std::string stdoutPath = dir + "/stdout";
+  int out = open (stdoutPath.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  NS_ABORT_MSG_IF (out < 0, "Cannot open " << stdoutPath);
+  dup2 (out, STDOUT_FILENO);
+  close (out);
+}
+
+bool
+WarmStartBrancher::IsParent (void) const
+{
+  return m_parent;
+}
+
+int
+WarmStartBrancher::PrintReport (std::ostream &os) const
+{
+  int failed = 0;
+  os << "branches: " << m_param << " from " << Simulator::Now ().GetSeconds () << "s" << std::endl;
+  for (uint32_t k = 0; k < m_status.size (); ++k)
+    {
+      int status = m_status[k];
+      bool ok = WIFEXITED (status) && WEXITSTATUS (status) == 0;
+      failed += !ok;
+      os << "  branch-" << k << ": " << m_param << "=" << m_values[k] << " ";
+      if (WIFEXITED (status))
+        {
+          os << "exit=" << WEXITSTATUS (status);
+        }
+      else
+        {
+          os << "signal=" << WTERMSIG (status);
+        }
+      os << std::endl;
+    }
+  return failed ? 1 : 0;
+}
+
+static void
+SetErrorRate (Ptr<RateErrorModel> em, std::string value)
+{
+  em->SetAttribute ("ErrorRate", DoubleValue (std::stod (value)));
+}
+
+static void
+SetDeviceRate (std::vector<Ptr<NetDevice> > devices, std::string value)
+{
+  for (Ptr<NetDevice> device : devices)
+    {
+      device->SetAttribute ("DataRate", StringValue (value));
+    }
+}
+
+static void
+SetChannelDelay (std::vector<Ptr<Channel> > channels, std::string value)
+{
+  for (Ptr<Channel> channel : channels)
+    {
+      channel->SetAttribute ("Delay", StringValue (value));
+    }
+}
+
+/**
+ * A local process attached to the chain for --emulate.  An FdNetDevice on
+ * the node exchanges Ethernet frames with the process over a datagram
+ * socketpair, so the process needs a user-space stack (or a frame
+ * generator) but no root, TAP device or network.  It is started through
+ * /bin/sh with the descriptor and its addressing in the environment:
+ * TCPCHAIN_FD, TCPCHAIN_ADDRESS (a /24 address), TCPCHAIN_GATEWAY (the
+ * node) and TCPCHAIN_PEER (the process at the other end of the chain).
+ * Both ends of every socketpair are close-on-exec, and a child gets only
+ * its own end, as descriptor 3, so one process cannot hold another's
+ * socket open.
+ */
+class EmulatedHost : public SimpleRefCount<EmulatedHost>
+{
+public:
+  /**
+   * \param node The chain node the process hangs off.
+   * \param subnet The /24 shared by the node (.1) and the process (.2).
+   * \param command Shell command run as the process.
+   */
+  EmulatedHost (Ptr<Node> node, std::string subnet, std::string command);
+
+  Ipv4Address GetAddress (void) const;
+  /** \param peer The address the process should talk to. */
+  void Launch (Ipv4Address peer);
+  /** Terminate the process and wait for it. */
+  void Stop (void);
+
+private:
+  static const int CHILD_FD = 3;  //!< the process's end, as the process sees it
+
+  std::string m_command;
+  Ipv4Address m_address;
+  Ipv4Address m_gateway;
+  int         m_fd;   //!< the process's end of the socketpair
+  pid_t       m_pid;
+};
+
+EmulatedHost::EmulatedHost (Ptr<Node> node, std::string subnet, std::string command)
+  : m_command (command),
+    m_pid (-1)
+{
+  int fds[2];
+  if (socketpair (AF_UNIX, SOCK_DGRAM, 0, fds) < 0)
+    {
+      NS_FATAL_ERROR ("socketpair failed: " << std::strerror (errno));
+    }
+  m_fd = fds[1];
+  fcntl (fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl (fds[1], F_SETFD, FD_CLOEXEC);
+
+  FdNetDeviceHelper fdHelper;
+  NetDeviceContainer devices = fdHelper.Install (node);
+  DynamicCast<FdNetDevice> (devices.Get (0))->SetFileDescriptor (fds[0]);
+
+  Ipv4AddressHelper ipv4;
+  ipv4.SetBase (subnet.c_str (), "255.255.255.0");
+  m_gateway = ipv4.Assign (devices).GetAddress (0);
+  m_address = ipv4.NewAddress ();
+}
+
+Ipv4Address
+EmulatedHost::GetAddress (void) const
+{
+  return m_address;
+}
+
+void
+EmulatedHost::Launch (Ipv4Address peer)
+{
+  std::ostringstream address, gateway, target;
+  address << m_address << "/24";
+  gateway << m_gateway;
+  target << peer;
+  m_pid = fork ();
+  if (m_pid < 0)
+    {
+      NS_FATAL_ERROR ("fork failed: " << std::strerror (errno));
+    }
+  if (m_pid == 0)
+    {
+      // dup2 clears close-on-exec on the copy, but does nothing if the
+      // descriptor already has that number.
+      if (m_fd == CHILD_FD)
+        {
+          fcntl (m_fd, F_SETFD, 0);
+        }
+      else if (dup2 (m_fd, CHILD_FD) < 0)
+        {
+          _exit (127);
+        }
+      setenv ("TCPCHAIN_FD", std::to_string (CHILD_FD).c_str (), 1);
+      setenv ("TCPCHAIN_ADDRESS", address.str ().c_str (), 1);
+      setenv ("TCPCHAIN_GATEWAY", gateway.str ().c_str (), 1);
+      setenv ("TCPCHAIN_PEER", target.str ().c_str (), 1);
+      execl ("/bin/sh", "sh", "-c", m_command.c_str (), (char *) 0);
+      _exit (127);
+    }
+  close (m_fd);
+}
+
+void
+EmulatedHost::Stop (void)
+{
+  if (m_pid > 0)
+    {
+      kill (m_pid, SIGTERM);
+      waitpid (m_pid, 0, 0);
+      m_pid = -1;
+    }
+}
+
+/**
+ * How far the real-time simulator runs behind the wall clock: every
+ * interval, the wall time elapsed since the start minus the simulated time
+ * elapsed.  Real-time events never run early, so this is how late they
+ * run; beyond the limit, what the emulated hosts see no longer matches
+ * the simulated chain.
+ */
+class RealtimeLagMonitor : public SimpleRefCount<RealtimeLagMonitor>
+{
+public:
+  /**
+   * \param interval Sampling interval, in simulated time.
+   * \param limit Lag beyond which the emulation is reported as behind.
+   */
+  RealtimeLagMonitor (Time interval, Time limit);
+
+  void Start (void);
+  void PrintReport (std::ostream &os) const;
+
+private:
+  void Sample (void);
+
+  Time                                  m_interval;
+  Time                                  m_limit;
+  std::chrono::steady_clock::time_point m_wallStart;
+  Time                                  m_simStart;
+  LatencyHistogram                      m_lag;
+  uint64_t                              m_behind;       //!< samples over m_limit
+  Time                                  m_firstBehind;  //!< simulated time of the first
+};
+
+RealtimeLagMonitor::RealtimeLagMonitor (Time interval, Time limit)
+  : m_interval (interval),
+    m_limit (limit),
+    m_behind (0)
+{
+}
+
+void
+RealtimeLagMonitor::Start (void)
+{
+  m_wallStart = std::chrono::steady_clock::now ();
+  m_simStart = Simulator::Now ();
+  ScheduleMember (m_interval, &RealtimeLagMonitor::Sample, this);
+}
+
+void
+RealtimeLagMonitor::Sample (void)
+{
+  int64_t wallNs = std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::steady_clock::now () - m_wallStart).count ();
+  int64_t lagNs = std::max<int64_t> (wallNs - (Simulator::Now () - m_simStart).GetNanoSeconds (), 0);
+  m_lag.Record (static_cast<uint64_t> (lagNs));
+  if (lagNs > m_limit.GetNanoSeconds ())
+    {
+      if (m_behind++ == 0)
+        {
+          m_firstBehind = Simulator::Now ();
+          NS_LOG_UNCOND ("emulation: " << lagNs / 1e6 << "ms behind the wall clock at "
+                         << Simulator::Now ().GetSeconds () << "s");
+        }
+    }
+  ScheduleMember (m_interval, &RealtimeLagMonitor::Sample, this);
+}
+
+void
+RealtimeLagMonitor::PrintReport (std::ostream &os) const
+{
+  os << "emulation: samples=" << m_lag.GetCount ()
+     << " behind=" << m_behind << " (lag > " << m_limit.GetMilliSeconds () << "ms)";
+  if (m_behind)
+    {
+      os << " firstBehind=" << m_firstBehind.GetSeconds () << "s";
+    }
+  os << std::endl;
+  m_lag.PrintSummary (os, "real-time lag");
+}
+
+/**
+ * Soak-run leak detector.  Every interval it samples a set of named
+ * components (RSS, pending events, device and queue disc packets, socket buffers, ...)
+ * into sixth.soak.  After the warm-up it keeps running least-squares sums
+ * per component, so memory does not grow with the length of the run, and
+ * at the end it flags as growing those whose fitted growth over the fitted
+ * window exceeds a fraction of their mean, with the line explaining at
+ * least half of the variance (R^2 >= 0.5), so steady sawtooth use is not
+ * taken for a leak.
+ */
+class SoakMonitor : public SimpleRefCount<SoakMonitor>
+{
+public:
+  /**
+   * \param interval Sampling interval.
+   * \param fitStart Samples before this time are written but left out of the fit.
+   * \param stream Receives a header and one line per sample.
+   */
+  SoakMonitor (Time interval, Time fitStart, Ptr<OutputStreamWrapper> stream);
+
+  /**
+   * \param name Column name, also used when flagging.
+   * \param sampler Returns the component's current size.
+   */
+  void AddComponent (std::string name, Callback<double> sampler);
+  void Start (void);
+  /**
+   * \param growthLimit Fitted growth, relative to the mean, that flags a component.
+   * \return The number of components flagged as growing.
+   */
+  uint32_t PrintReport (std::ostream &os, double growthLimit) const;
+
+private:
+  /** Running mean and co-moments (Welford) of one component against time. */
+  struct Fit
+  {
+    double meanV;
+    double ctv;  //!< sum of (t - mean t) (v - mean v)
+    double cvv;  //!< sum of (v - mean v)^2
+  };
+
+  void Sample (void);
+
+  Time                            m_interval;
+  Time                            m_fitStart;
+  Ptr<OutputStreamWrapper>        m_stream;
+  std::vector<std::string>        m_names;
+  std::vector<Callback<double> >  m_samplers;
+  std::vector<Fit>                m_fits;
+  uint64_t                        m_samples;
+  uint64_t                        m_fitted;
+  double                          m_firstT;  //!< seconds, first fitted sample
+  double                          m_lastT;
+  double                          m_meanT;
+  double                          m_ctt;     //!< sum of (t - mean t)^2
+};
+
+SoakMonitor::SoakMonitor (Time interval, Time fitStart, Ptr<OutputStreamWrapper> stream)
+  : m_interval (interval),
+    m_fitStart (fitStart),
+    m_stream (stream),
+    m_samples (0),
+    m_fitted (0),
+    m_firstT (0),
+    m_lastT (0),
+    m_meanT (0),
+    m_ctt (0)
+{
+}
+
+void
+SoakMonitor::AddComponent (std::string name, Callback<double> sampler)
+{
+  m_names.push_back (name);
+  m_samplers.push_back (sampler);
+  m_fits.push_back (Fit {0, 0, 0});
+}
+
+void
+SoakMonitor::Start (void)
+{
+  std::ostream &os = *m_stream->GetStream ();
+  os << "# time";
+  for (const std::string &name : m_names)
+    {
+      os << "\t" << name;
+    }
+  os << std::endl;
+  ScheduleMember (m_interval, &SoakMonitor::Sample, this);
+}
+
+void
+SoakMonitor::Sample (void)
+{
+  std::ostream &os = *m_stream->GetStream ();
+  double t = Simulator::Now ().GetSeconds ();
+  bool fit = Simulator::Now () >= m_fitStart;
+  ++m_samples;
+  double dt = 0;
+  if (fit)
+    {
+      if (m_fitted++ == 0)
+        {
+          m_firstT = t;
+        }
+      m_lastT = t;
+      dt = t - m_meanT;
+      m_meanT += dt / m_fitted;
+      m_ctt += dt * (t - m_meanT);
+    }
+  os << t;
+  for (uint32_t c = 0; c < m_samplers.size (); ++c)
+    {
+      double v = m_samplers[c] ();
+      os << "\t" << v;
+      if (fit)
+        {
+          Fit &f = m_fits[c];
+          double dv = v - f.meanV;
+          f.meanV += dv / m_fitted;
+          f.ctv += dt * (v - f.meanV);
+          f.cvv += dv * (v - f.meanV);
+        }
+    }
+  os << std::endl;
+  ScheduleMember (m_interval, &SoakMonitor::Sample, this);
+}
+
+uint32_t
+SoakMonitor::PrintReport (std::ostream &os, double growthLimit) const
+{
+  os << "soak: samples=" << m_samples << " fitted=" << m_fitted << " (sixth.soak)" << std::endl;
+  if (m_fitted < 3)
+    {
+      os << "soak: too few samples after the warm-up to fit a trend" << std::endl;
+      return 0;
+    }
+  double span = m_lastT - m_firstT;
+  uint32_t growing = 0;
+  for (uint32_t c = 0; c < m_names.size (); ++c)
+    {
+      const Fit &f = m_fits[c];
+      double slope = m_ctt > 0 ? f.ctv / m_ctt : 0;
+      double r2 = m_ctt > 0 && f.cvv > 0 ? f.ctv * f.ctv / (m_ctt * f.cvv) : 0;
+      double relative = slope * span / std::max (std::fabs (f.meanV), 1.0);
+      bool flagged = relative > growthLimit && r2 >= 0.5;
+      growing += flagged;
+      os << "  " << m_names[c] << ": mean=" << f.meanV << " slope=" << slope << "/s"
+         << " growth=" << 100 * relative << "% r2=" << r2
+         << (flagged ? " GROWING" : "") << std::endl;
+    }
+  return growing;
+}
+
+static double
+SampleRss (void)
+{
+  return GetRssBytes () / 1024.0;
+}
+
+static double
+SamplePendingEvents (void)
+{
+  return CountingScheduler::GetPending ();
+}
+
+#ifndef TCPCHAIN_SYSTEM_ALLOC
+/**
+ * \return Live operator new allocations of any type and size.  A proxy for
+ *         leaked objects (packets, events, callbacks, ...), not a count of
+ *         any one of them.
+ */
+static double
+SampleLiveAllocations (void)
+{
+  uint64_t live = 0;
+  for (std::size_t c = 0; c <= PoolAllocator::N_CLASSES; ++c)
+    {
+      live += PoolLoad (g_pool.allocs[c]) - PoolLoad (g_pool.frees[c]);
+    }
+  return live;
+}
+#endif
+
+static double
+SampleQueuedPackets (std::vector<Ptr<NetDevice> > devices)
+{
+  uint64_t packets = 0;
+  for (Ptr<NetDevice> device : devices)
+    {
+      packets += DynamicCast<PointToPointNetDevice> (device)->GetQueue ()->GetNPackets ();
+    }
+  return packets;
+}
+
+/** Packets held by the root queue discs, which sit in front of the device queues. */
+static double
+SampleQueueDiscPackets (std::vector<Ptr<NetDevice> > devices)
+{
+  uint64_t packets = 0;
+  for (Ptr<NetDevice> device : devices)
+    {
+      Ptr<QueueDisc> qdisc = GetRootQueueDisc (device);
+      if (qdisc)
+        {
+          packets += qdisc->GetNPackets ();
+        }
+    }
+  return packets;
+}
+
+static double
+SampleSendBuffers (std::vector<Ptr<Socket> > sockets)
+{
+  uint64_t bytes = 0;
+  for (Ptr<Socket> socket : sockets)
+    {
+      UintegerValue size;
+      socket->GetAttribute ("SndBufSize", size);
+      bytes += size.Get () - std::min<uint64_t> (socket->GetTxAvailable (), size.Get ());
+    }
+  return bytes;
+}
+
+static double
+SampleReceiveBuffers (Ptr<PacketSink> sink)
+{
+  uint64_t bytes = 0;
+  for (Ptr<Socket> socket : sink->GetAcceptedSockets ())
+    {
+      bytes += socket->GetRxAvailable ();
+    }
+  return bytes;
+}
+
+int
+main (int argc, char *argv[])
+{
+  bool cwndTimeNs = false;
+  bool cwndBinary = false;
+  bool scripted = false;
+  std::string packetSizes = "fixed";
+  std::string workload = "bulk";
+  double rpcRate = 200;
+  uint32_t rpcResponseSize = 4096;
+  bool rpcReuse = true;
+  uint32_t rpcConnections = 4;
+  uint32_t rpcMaxOutstanding = 4096;
+  double flowRate = 100;
+  uint64_t flowCount = 0;
+  uint32_t flowMaxActive = 10000;
+  double flowParetoShape = 1.2;
+  double flowParetoScale = 2000;
+  double simTime = 20;
+  std::string stack = "full";
+  uint32_t stackBenchNodes = 0;
+  std::string capture = "";
+  std::string captureDevices = "1";
+  uint32_t hops = 3;
+  std::string linkRate = "5Mbps";
+  std::string linkDelay = "2ms";
+  std::string queueSize = "100p";
+  double errorRate = 0.00001;
+  uint32_t nFlows = 1;
+  bool anim = true;
+  bool runStats = false;
+  std::string appRate = "1Mbps";
+  std::string tcp = "";
+  bool ecn = false;
+  int32_t ecnHop = -1;
+  uint32_t ecnThreshold = 20;
+  std::string bottleneckRate = "";
+  uint32_t paths = 1;
+  std::string ecmp = "flow";
+  std::string edgeRate = "";
+  uint32_t hopSample = 0;
+  uint32_t traceFlows = 0;
+  std::string drops = "pcap";
+  std::string dropBin = "100ms";
+  bool sendBufferDelay = false;
+  bool poolAlloc = false;
+  uint64_t poolReserveMb = 1024;
+  uint32_t appPackets = 1000;
+  bool recycleEvents = true;
+  std::string scheduler = "map";
+  std::string branchAt = "";
+  std::string branch = "";
+  bool emulate = false;
+  std::string emuClient = "";
+  std::string emuServer = "";
+  std::string emuLagInterval = "10ms";
+  std::string emuLagLimit = "10ms";
+  std::string limits = "";
+  std::string soak = "";
+  double soakWarmup = 0.2;
+  double soakGrowth = 0.1;
+  double limitsLinkBusy = 0.95;
+
+  CommandLine cmd;
+  cmd.AddValue ("cwndTimeNs", "Write sixth.cwnd with integer nanosecond timestamps (set ts = 1e-9 in gnu_plot_file)", cwndTimeNs);
+  cmd.AddValue ("cwndBinary", "Write the cwnd trace as 16-byte binary records to sixth.cwnd.bin, for tcpchain-analyze", cwndBinary);
+  cmd.AddValue ("scripted", "Drive the bulk flows with the coroutine ScriptedApp instead of MyApp (needs C++20; honours appRate, appPackets and recycleEvents)", scripted);
+  cmd.AddValue ("packetSizes", "MyApp payload sizes: fixed (1040 bytes), imix, or the path of an empirical CDF file", packetSizes);
+  cmd.AddValue ("workload", "Traffic on the chain: bulk (MyApp), rpc (RpcClient/RpcServer) or flows (Poisson short flows)", workload);
+  cmd.AddValue ("rpcRate", "RPC requests per second (Poisson arrivals)", rpcRate);
+  cmd.AddValue ("rpcResponseSize", "RPC response size in bytes", rpcResponseSize);
+  cmd.AddValue ("rpcReuse", "Share rpcConnections persistent connections (true) or open one per request (false)", rpcReuse);
+  cmd.AddValue ("rpcConnections", "Persistent RPC connections when rpcReuse is set", rpcConnections);
+  cmd.AddValue ("rpcMaxOutstanding", "RPC request slots; arrivals beyond this are rejected", rpcMaxOutstanding);
+  cmd.AddValue ("flowRate", "Short-flow arrivals per second (Poisson)", flowRate);
+  cmd.AddValue ("flowCount", "Short flows to start in total; 0 for no limit", flowCount);
+  cmd.AddValue ("flowMaxActive", "Concurrent short flows; arrivals beyond this are rejected", flowMaxActive);
+  cmd.AddValue ("flowParetoShape", "Shape of the bounded Pareto short-flow size distribution", flowParetoShape);
+  cmd.AddValue ("flowParetoScale", "Scale (minimum size, bytes) of the short-flow size distribution", flowParetoScale);
+  cmd.AddValue ("simTime", "Simulated seconds", simTime);
+  cmd.AddValue ("stack", "Protocol stack per node: full (InternetStackHelper) or lean (IPv4+ARP+ICMP, TCP on endpoints)", stack);
+  cmd.AddValue ("stackBenchNodes", "Only report setup time and RSS of installing --stack on this many nodes", stackBenchNodes);
+  cmd.AddValue ("capture", "Capture filter, e.g. \"syn or retx\"; writes sixth-filter-<dev>.pcap for each of captureDevices", capture);
+  cmd.AddValue ("captureDevices", "Comma-separated chain devices to capture on (2i and 2i+1 are the ends of link i)", captureDevices);
+  cmd.AddValue ("hops", "Point-to-point links between term_0 and term_3, or on each path with --paths", hops);
+  cmd.AddValue ("paths", "Parallel chains between fan-out nodes next to term_0 and term_3; links are numbered edge, path 0 .. path K-1, edge", paths);
+  cmd.AddValue ("ecmp", "Load balancing over --paths: flow (five-tuple hash) or packet (random per-packet spraying)", ecmp);
+  cmd.AddValue ("edgeRate", "Data rate of the two edge links with --paths; empty for paths times linkRate", edgeRate);
+  cmd.AddValue ("linkRate", "Data rate of every chain link", linkRate);
+  cmd.AddValue ("linkDelay", "Propagation delay of every chain link", linkDelay);
+  cmd.AddValue ("queueSize", "Device queue size of every chain link", queueSize);
+  cmd.AddValue ("errorRate", "Receive error rate on the middle link (of path 0 with --paths)", errorRate);
+  cmd.AddValue ("nFlows", "Parallel bulk (MyApp) flows from term_0 to term_3", nFlows);
+  cmd.AddValue ("anim", "Write animation.xml", anim);
+  cmd.AddValue ("runStats", "Print event count, wall time, peak RSS and bulk goodput after the run", runStats);
+  cmd.AddValue ("appRate", "Sending rate of each bulk (MyApp) flow", appRate);
+  cmd.AddValue ("tcp", "TCP congestion control ns3::Tcp<name>, e.g. NewReno or Dctcp; empty keeps the ns-3 default", tcp);
+  cmd.AddValue ("ecn", "Negotiate ECN on TCP sockets", ecn);
+  cmd.AddValue ("ecnHop", "Link whose sending queue marks CE at ecnThreshold (StepMarkQueueDisc); -1 for none", ecnHop);
+  cmd.AddValue ("ecnThreshold", "Step marking threshold in packets", ecnThreshold);
+  cmd.AddValue ("bottleneckRate", "Data rate of the ecnHop link; empty keeps linkRate", bottleneckRate);
+  cmd.AddValue ("hopSample", "Tag one in this many packets from term_0 with per-hop timestamps and report per-hop delays; 0 to disable", hopSample);
+  cmd.AddValue ("traceFlows", "Hash-sample about this many flows for sixth-flows.{cwnd,rtt,drop}; 0 to disable", traceFlows);
+  cmd.AddValue ("drops", "Drop output: pcap (RxDrop on one device to sixth.pcap) or binned (per-device counts to sixth.drops)", drops);
+  cmd.AddValue ("dropBin", "Time bin of --drops=binned", dropBin);
+  cmd.AddValue ("sendBufferDelay", "Report the delay from MyApp Send to transmission at ndc_hub_3.Get (0)", sendBufferDelay);
+  cmd.AddValue ("poolAlloc", "Serve small allocations from the size-class pool allocator", poolAlloc);
+  cmd.AddValue ("poolReserveMb", "Address space reserved for the pool slabs", poolReserveMb);
+  cmd.AddValue ("appPackets", "Packets each bulk MyApp sends before stopping", appPackets);
+  cmd.AddValue ("recycleEvents", "Reschedule one pooled send event per MyApp instead of allocating one per packet (with --scripted, take the script's wake-up events from a pool)", recycleEvents);
+  cmd.AddValue ("scheduler", "Event scheduler: map, heap, list, calendar or wheel (TimerWheelScheduler; pays off from about 5,000 flows)", scheduler);
+  cmd.AddValue ("branchAt", "Simulate to this time once, then fork one process per --branch value; empty to disable", branchAt);
+  cmd.AddValue ("emulate", "Run in real time with emuClient and emuServer attached to term_0 and term_3 by FdNetDevice socketpairs", emulate);
+  cmd.AddValue ("emuClient", "Shell command of the process on term_0 (Ethernet frames on fd $TCPCHAIN_FD, address $TCPCHAIN_ADDRESS, peer $TCPCHAIN_PEER)", emuClient);
+  cmd.AddValue ("emuServer", "Shell command of the process on term_3, as emuClient", emuServer);
+  cmd.AddValue ("emuLagInterval", "How often --emulate samples the real-time lag", emuLagInterval);
+  cmd.AddValue ("emuLagLimit", "Real-time lag beyond which --emulate reports the emulation as behind", emuLagLimit);
+  cmd.AddValue ("limits", "Label each interval of this length as app-, cwnd-, rwnd- or link-limited for the first bulk flow (sixth.limits); empty to disable", limits);
+  cmd.AddValue ("limitsLinkBusy", "Utilization of the busiest forward link from which --limits labels an interval link-limited", limitsLinkBusy);
+  cmd.AddValue ("soak", "Sample RSS, pending events, live heap allocations (a proxy for leaked objects), device and queue disc packets and socket buffers at this interval into sixth.soak and flag growing ones; empty to disable", soak);
+  cmd.AddValue ("soakWarmup", "Fraction of simTime sampled by --soak but left out of the trend fit", soakWarmup);
+  cmd.AddValue ("soakGrowth", "Fitted growth over the --soak window, relative to the mean, that flags a component", soakGrowth);
+  cmd.AddValue ("branch", "Parameter and values for --branchAt, e.g. errorRate:1e-4,1e-3 (errorRate, linkRate or linkDelay); outputs go to branch-<k>/", branch);
+  cmd.Parse (argc, argv);
+  NS_ABORT_MSG_IF (poolAlloc && emulate, "--poolAlloc is single-threaded and cannot be combined with --emulate");
+  NS_ABORT_MSG_IF (scripted && packetSizes != "fixed", "--scripted sends fixed 1040-byte packets; --packetSizes needs MyApp");
+  NS_ABORT_MSG_IF (scripted && sendBufferDelay, "--scripted does not tag send times; --sendBufferDelay needs MyApp");
+  if (poolAlloc)
+    {
+      PoolEnable (poolReserveMb);
+    }
+  if (emulate)
+    {
+      NS_ABORT_MSG_IF (emuClient.empty () || emuServer.empty (), "--emulate needs --emuClient and --emuServer");
+      NS_ABORT_MSG_IF (!branchAt.empty (), "--emulate cannot be combined with --branchAt");
+      GlobalValue::Bind ("SimulatorImplementationType", StringValue ("ns3::RealtimeSimulatorImpl"));
+      GlobalValue::Bind ("ChecksumEnabled", BooleanValue (true));
+    }
+  ObjectFactory schedulerFactory = SchedulerFactory (scheduler);
+  if (!soak.empty ())
+    {
+      // Count the pending events around the chosen scheduler.
+      std::string inner = schedulerFactory.GetTypeId ().GetName ();
+      schedulerFactory.SetTypeId (CountingScheduler::GetTypeId ());
+      schedulerFactory.Set ("Scheduler", StringValue (inner));
+    }
+  Simulator::SetScheduler (schedulerFactory);
+  if (stackBenchNodes > 0)
+    {
+      BenchmarkStackInstall (stackBenchNodes, stack == "lean");
+      return 0;
+    }
+  if (workload != "bulk" && workload != "rpc" && workload != "flows")
+    {
+      NS_FATAL_ERROR ("Unknown --workload " << workload);
+    }
+  if (drops != "pcap" && drops != "binned")
+    {
+      NS_FATAL_ERROR ("Unknown --drops " << drops);
+    }
+  NS_ABORT_MSG_IF (hops == 0, "--hops must be at least 1");
+  NS_ABORT_MSG_IF (paths == 0, "--paths must be at least 1");
+  uint32_t nLinks = paths == 1 ? hops : paths * hops + 2;
+  NS_ABORT_MSG_IF (ecnHop >= static_cast<int32_t> (nLinks), "--ecnHop must name one of the " << nLinks << " links");
+  if (ecmp != "flow" && ecmp != "packet")
+    {
+      NS_FATAL_ERROR ("Unknown --ecmp " << ecmp);
+    }
+  if (paths > 1 && ecmp == "packet")
+    {
+      Config::SetDefault ("ns3::Ipv4GlobalRouting::RandomEcmpRouting", BooleanValue (true));
+    }
+  if (!tcp.empty ())
+    {
+      Config::SetDefault ("ns3::TcpL4Protocol::SocketType", StringValue ("ns3::Tcp" + tcp));
+    }
+  if (ecn)
+    {
+      Config::SetDefault ("ns3::TcpSocketBase::UseEcn", StringValue ("On"));
+    }
+
+  //NodeContainer nodes;
+  //nodes.Create (2);
+  /* Build nodes.  term_0 and term_3 are the chain ends, with --hops links
+     between them; the default of 3 gives the original term_0..term_3.
+     With --paths=K, term_0 and term_3 hang off fan-out nodes joined by K
+     parallel chains of --hops links each. */
+  NodeContainer chain;
+  std::vector<std::pair<uint32_t, uint32_t> > linkEnds;
+  std::vector<std::pair<double, double> > positions;
+  std::vector<uint32_t> pathFirstLink;
+  std::vector<uint32_t> pathLastLink;
+  if (paths == 1)
+    {
+      chain.Create (hops + 1);
+      for (uint32_t i = 0; i <= hops; ++i)
+        {
+          positions.push_back (std::make_pair (1.0 + 10.0 * i, 2.0));
+          if (i < hops)
+            {
+              linkEnds.push_back (std::make_pair (i, i + 1));
+            }
+        }
+    }
+  else
+    {
+      // term_0, fan-out, path 0 .. path K-1 inner nodes, fan-in, term_3.
+      uint32_t inner = hops - 1;
+      chain.Create (4 + paths * inner);
+      uint32_t fanOut = 1;
+      uint32_t fanIn = chain.GetN () - 2;
+      positions.resize (chain.GetN ());
+      positions[0] = std::make_pair (1.0, 2.0 + 5.0 * (paths - 1));
+      positions[fanOut] = std::make_pair (11.0, positions[0].second);
+      positions[fanIn] = std::make_pair (21.0 + 10.0 * inner, positions[0].second);
+      positions[fanIn + 1] = std::make_pair (31.0 + 10.0 * inner, positions[0].second);
+      linkEnds.push_back (std::make_pair (0, fanOut));
+      for (uint32_t k = 0; k < paths; ++k)
+        {
+          uint32_t prev = fanOut;
+          pathFirstLink.push_back (linkEnds.size ());
+          for (uint32_t j = 0; j < inner; ++j)
+            {
+              uint32_t node = 2 + k * inner + j;
+              positions[node] = std::make_pair (21.0 + 10.0 * j, 2.0 + 10.0 * k);
+              linkEnds.push_back (std::make_pair (prev, node));
+              prev = node;
+            }
+          pathLastLink.push_back (linkEnds.size ());
+          linkEnds.push_back (std::make_pair (prev, fanIn));
+        }
+      linkEnds.push_back (std::make_pair (fanIn, fanIn + 1));
+      if (edgeRate.empty ())
+        {
+          edgeRate = std::to_string (DataRate (linkRate).GetBitRate () * paths) + "bps";
+        }
+    }
+  NodeContainer term_0 (chain.Get (0));
+  NodeContainer term_3 (chain.Get (chain.GetN () - 1));
 
   //NetDeviceContainer devices;
   //devices = pointToPoint.Install (nodes);
-  /* Build link net device container. */
-  NodeContainer all_hub_3;
-  all_hub_3.Add (term_0);
-  all_hub_3.Add (term_1);
-  NetDeviceContainer ndc_hub_3 = pointToPoint_1.Install (all_hub_3);
-  NodeContainer all_hub_4;
-  all_hub_4.Add (term_1);
-  all_hub_4.Add (term_2);
-  NetDeviceContainer ndc_hub_4 = pointToPoint_2.Install (all_hub_4);
-  NodeContainer all_hub_5;
-  all_hub_5.Add (term_2);
-  all_hub_5.Add (term_3);
-  NetDeviceContainer ndc_hub_5 = pointToPoint_3.Install (all_hub_5);
+  /* Build link net device containers; link i joins chain nodes linkEnds[i]. */
+  std::vector<NetDeviceContainer> links;
+  for (uint32_t i = 0; i < nLinks; ++i)
+    {
+      bool edge = paths > 1 && (i == 0 || i == nLinks - 1);
+      PointToPointHelper pointToPoint;
+      pointToPoint.SetDeviceAttribute ("DataRate", StringValue (edge ? edgeRate : linkRate));
+      pointToPoint.SetChannelAttribute ("Delay", StringValue (linkDelay));
+      pointToPoint.SetQueue ("ns3::DropTailQueue<Packet>", "MaxSize", StringValue (queueSize));
+      if (static_cast<int32_t> (i) == ecnHop)
+        {
+          // Keep the backlog in the marking queue disc, not the device.
+          pointToPoint.SetQueue ("ns3::DropTailQueue<Packet>", "MaxSize", StringValue ("1p"));
+          if (!bottleneckRate.empty ())
+            {
+              pointToPoint.SetDeviceAttribute ("DataRate", StringValue (bottleneckRate));
+            }
+        }
+      links.push_back (pointToPoint.Install (chain.Get (linkEnds[i].first), chain.Get (linkEnds[i].second)));
+    }
+  NetDeviceContainer ndc_hub_3 = links.front ();
 
   Ptr<RateErrorModel> em = CreateObject<RateErrorModel> ();
-  em->SetAttribute ("ErrorRate", DoubleValue (0.00001));
-  ndc_hub_4.Get (1)->SetAttribute ("ReceiveErrorModel", PointerValue (em));
+  em->SetAttribute ("ErrorRate", DoubleValue (errorRate));
+  links[paths == 1 ? hops / 2 : 1 + hops / 2].Get (1)->SetAttribute ("ReceiveErrorModel", PointerValue (em));
 
   //InternetStackHelper stack;
   //stack.Install (nodes);
 
   InternetStackHelper internetStackH;
-  internetStackH.Install (term_0);
-  internetStackH.Install (term_1);
-  internetStackH.Install (term_2);
-  internetStackH.Install (term_3);
+  for (uint32_t i = 0; i < chain.GetN (); ++i)
+    {
+      if (stack == "lean")
+        {
+          InstallLeanStack (chain.Get (i), i == 0 || i == chain.GetN () - 1);
+        }
+      else
+        {
+          internetStackH.Install (chain.Get (i));
+        }
+    }
 
   //Ipv4AddressHelper address;
   //address.SetBase ("10.1.1.0", "255.255.255.252");
   //Ipv4InterfaceContainer interfaces = address.Assign (devices);
-  /* IP assign. */
+  Ptr<StepMarkQueueDisc> ecnQueue;
+  if (ecnHop >= 0)
+    {
+      // Installed before Ipv4AddressHelper::Assign, which would otherwise add the default queue disc.
+      TrafficControlHelper tch;
+      tch.SetRootQueueDisc ("StepMarkQueueDisc", "MarkThreshold", UintegerValue (ecnThreshold));
+      QueueDiscContainer qdiscs = tch.Install (links[ecnHop].Get (0));
+      ecnQueue = DynamicCast<StepMarkQueueDisc> (qdiscs.Get (0));
+    }
+
+  /* IP assign: link i gets 10.<i / 256>.<i % 256>.0/24. */
   Ipv4AddressHelper ipv4;
-  ipv4.SetBase ("10.0.0.0", "255.255.255.0");
-  Ipv4InterfaceContainer iface_ndc_hub_3 = ipv4.Assign (ndc_hub_3);
-  ipv4.SetBase ("10.0.1.0", "255.255.255.0");
-  Ipv4InterfaceContainer iface_ndc_hub_4 = ipv4.Assign (ndc_hub_4);
-  ipv4.SetBase ("10.0.2.0", "255.255.255.0");
-  Ipv4InterfaceContainer iface_ndc_hub_5 = ipv4.Assign (ndc_hub_5);
+  std::vector<Ipv4InterfaceContainer> ifaces;
+  for (uint32_t i = 0; i < nLinks; ++i)
+    {
+      std::ostringstream subnet;
+      subnet << "10." << i / 256 << "." << i % 256 << ".0";
+      ipv4.SetBase (subnet.str ().c_str (), "255.255.255.0");
+      ifaces.push_back (ipv4.Assign (links[i]));
+    }
+  Ipv4Address sinkIp = ifaces.back ().GetAddress (1);
+
+  /* --emulate: the emulated hosts sit on their own subnets off the chain ends. */
+  std::vector<Ptr<EmulatedHost> > emulatedHosts;
+  if (emulate)
+    {
+      emulatedHosts.push_back (Create<EmulatedHost> (term_0.Get (0), "192.168.1.0", emuClient));
+      emulatedHosts.push_back (Create<EmulatedHost> (term_3.Get (0), "192.168.2.0", emuServer));
+    }
 
    /* Generate Route. */
   Ipv4GlobalRoutingHelper::PopulateRoutingTables ();
+  if (paths > 1 && ecmp == "flow")
+    {
+      /* The fan-out node spreads flows towards term_3 over the first links
+         of the paths, the fan-in node spreads their ACKs over the last. */
+      Ptr<Node> fanOut = chain.Get (1);
+      Ptr<Node> fanIn = chain.Get (chain.GetN () - 2);
+      Ipv4Mask mask ("255.255.255.0");
+      std::vector<std::pair<Ipv4Address, uint32_t> > toTerm3;
+      std::vector<std::pair<Ipv4Address, uint32_t> > toTerm0;
+      for (uint32_t k = 0; k < paths; ++k)
+        {
+          uint32_t first = pathFirstLink[k];
+          uint32_t last = pathLastLink[k];
+          toTerm3.push_back (std::make_pair (ifaces[first].GetAddress (1),
+                                             fanOut->GetObject<Ipv4> ()->GetInterfaceForDevice (links[first].Get (0))));
+          toTerm0.push_back (std::make_pair (ifaces[last].GetAddress (0),
+                                             fanIn->GetObject<Ipv4> ()->GetInterfaceForDevice (links[last].Get (1))));
+        }
+      Ptr<FlowEcmpRouting> fanOutRouting = CreateObject<FlowEcmpRouting> ();
+      fanOutRouting->AddMultipathRoute (sinkIp.CombineMask (mask), mask, toTerm3);
+      DynamicCast<Ipv4ListRouting> (fanOut->GetObject<Ipv4> ()->GetRoutingProtocol ())->AddRoutingProtocol (fanOutRouting, 10);
+      Ptr<FlowEcmpRouting> fanInRouting = CreateObject<FlowEcmpRouting> ();
+      fanInRouting->AddMultipathRoute (ifaces.front ().GetAddress (0).CombineMask (mask), mask, toTerm0);
+      DynamicCast<Ipv4ListRouting> (fanIn->GetObject<Ipv4> ()->GetRoutingProtocol ())->AddRoutingProtocol (fanInRouting, 10);
+    }
 
   /* Generate Application. */
   uint16_t port_tcp_0 = 1090;
-  Address sinkAddress (InetSocketAddress (iface_ndc_hub_5.GetAddress (1), port_tcp_0));
+  Address sinkAddress (InetSocketAddress (sinkIp, port_tcp_0));
   Address sinkLocalAddress_tcp_0 (InetSocketAddress (Ipv4Address::GetAny (), port_tcp_0));
   PacketSinkHelper sinkHelper_tcp_0 ("ns3::TcpSocketFactory", sinkLocalAddress_tcp_0);
   ApplicationContainer sinkApp_tcp_0 = sinkHelper_tcp_0.Install (term_3);
   sinkApp_tcp_0.Start (Seconds (0.0));
-  sinkApp_tcp_0.Stop (Seconds (20.0));
+  sinkApp_tcp_0.Stop (Seconds (simTime));
 
-  Ptr<Socket> ns3TcpSocket = Socket::CreateSocket (term_3.Get(0), TcpSocketFactory::GetTypeId ()); //TODO find out which node to put here instead of term_0
+  Ptr<Socket> ns3TcpSocket = Socket::CreateSocket (term_0.Get (0), TcpSocketFactory::GetTypeId ());
+
+  /* Per-flow traces: expect nFlows bulk flows, flowCount short flows
+     (flowRate * simTime without a limit) or one RPC flow per connection
+     (rpcConnections, or one per request without rpcReuse), and sample
+     traceFlows of them. */
+  Ptr<FlowTraceSampler> flowTraces;
+  if (traceFlows > 0)
+    {
+      AsciiTraceHelper flowTraceHelper;
+      double expected = nFlows;
+      if (workload == "flows")
+        {
+          expected = flowCount ? flowCount : flowRate * simTime;
+        }
+      else if (workload == "rpc")
+        {
+          expected = rpcReuse ? rpcConnections : rpcRate * simTime;
+        }
+      flowTraces = Create<FlowTraceSampler> (traceFlows / std::max (expected, 1.0),
+                                             flowTraceHelper.CreateFileStream ("sixth-flows.cwnd"),
+                                             flowTraceHelper.CreateFileStream ("sixth-flows.rtt"),
+                                             flowTraceHelper.CreateFileStream ("sixth-flows.drop"));
+      if (workload == "bulk")
+        {
+          flowTraces->Attach (ns3TcpSocket);
+        }
+      for (uint32_t i = 0; i < nLinks; ++i)
+        {
+          for (uint32_t end = 0; end < 2; ++end)
+            {
+              links[i].Get (end)->TraceConnectWithoutContext ("PhyRxDrop", MakeCallback (&FlowTraceSampler::Drop, flowTraces));
+              links[i].Get (end)->TraceConnectWithoutContext ("MacTxDrop", MakeCallback (&FlowTraceSampler::Drop, flowTraces));
+              ConnectQueueDiscDrops (links[i].Get (end), MakeCallback (&FlowTraceSampler::QueueDiscDrop, flowTraces));
+            }
+        }
+    }
+
+  Ptr<Application> app;
+  Ptr<RpcClient> rpcClient;
+  Ptr<ShortFlowGenerator> flowGenerator;
+  Ptr<FlowSink> flowSink;
+  if (workload == "rpc")
+    {
+      uint16_t port_rpc = 1091;
+      Ptr<RpcServer> rpcServer = CreateObject<RpcServer> ();
+      rpcServer->Setup (port_rpc);
+      term_3.Get (0)->AddApplication (rpcServer);
+      rpcServer->SetStartTime (Seconds (0.));
+      rpcServer->SetStopTime (Seconds (simTime));
+
+      rpcClient = CreateObject<RpcClient> ();
+      rpcClient->Setup (InetSocketAddress (sinkIp, port_rpc),
+                        ParseSizeDistribution (packetSizes, 1040), rpcResponseSize,
+                        rpcRate, rpcReuse, rpcConnections, rpcMaxOutstanding);
+      if (flowTraces)
+        {
+          // The server end carries the responses; trace it as part of the same flow.
+          rpcClient->SetSocketCallback (MakeCallback (&FlowTraceSampler::Attach, flowTraces));
+          rpcServer->SetSocketCallback (MakeCallback (&FlowTraceSampler::AttachPeer, flowTraces));
+        }
+      app = rpcClient;
+    }
+  else if (workload == "flows")
+    {
+      uint16_t port_flows = 1092;
+      flowSink = CreateObject<FlowSink> ();
+      flowSink->Setup (port_flows, std::vector<uint32_t> {10000, 100000, 1000000});
+      term_3.Get (0)->AddApplication (flowSink);
+      flowSink->SetStartTime (Seconds (0.));
+      flowSink->SetStopTime (Seconds (simTime));
 
-  Ptr<MyApp> app = CreateObject<MyApp> ();
-  app->Setup (ns3TcpSocket, sinkAddress, 1040, 1000, DataRate ("1Mbps"));
+      Ptr<ParetoRandomVariable> flowSizes = CreateObject<ParetoRandomVariable> ();
+      flowSizes->SetAttribute ("Shape", DoubleValue (flowParetoShape));
+      flowSizes->SetAttribute ("Scale", DoubleValue (flowParetoScale));
+      flowSizes->SetAttribute ("Bound", DoubleValue (1e8));
+      flowGenerator = CreateObject<ShortFlowGenerator> ();
+      flowGenerator->Setup (InetSocketAddress (sinkIp, port_flows),
+                            flowSizes, flowRate, flowCount, flowMaxActive);
+      if (flowTraces)
+        {
+          flowGenerator->SetSocketCallback (MakeCallback (&FlowTraceSampler::Attach, flowTraces));
+        }
+      app = flowGenerator;
+    }
+  else if (scripted)
+    {
+      app = ConstantRateApp (ns3TcpSocket, sinkAddress, 1040, appPackets, DataRate (appRate), recycleEvents);
+    }
+  else
+    {
+      Ptr<MyApp> myApp = CreateObject<MyApp> ();
+      myApp->Setup (ns3TcpSocket, sinkAddress, 1040, appPackets, DataRate (appRate));
+      myApp->SetEventRecycling (recycleEvents);
+      if (sendBufferDelay)
+        {
+          myApp->EnableSendTimeTags ();
+        }
+      if (packetSizes != "fixed")
+        {
+          myApp->SetPacketSizeDistribution (ParseSizeDistribution (packetSizes, 1040));
+        }
+      app = myApp;
+    }
   term_0.Get (0)->AddApplication (app);
   app->SetStartTime (Seconds (0.));
-  app->SetStopTime (Seconds (20.));
+  app->SetStopTime (Seconds (simTime));
+
+  /* Further bulk flows share the sink; only the first one is traced. */
+  std::vector<Ptr<Socket> > bulkSockets (1, ns3TcpSocket);
+  for (uint32_t i = 1; workload == "bulk" && i < nFlows; ++i)
+    {
+      Ptr<Socket> extraSocket = Socket::CreateSocket (term_0.Get (0), TcpSocketFactory::GetTypeId ());
+      bulkSockets.push_back (extraSocket);
+      if (flowTraces)
+        {
+          flowTraces->Attach (extraSocket);
+        }
+      Ptr<Application> extra;
+      if (scripted)
+        {
+          extra = ConstantRateApp (extraSocket, sinkAddress, 1040, appPackets, DataRate (appRate), recycleEvents);
+        }
+      else
+        {
+          Ptr<MyApp> extraApp = CreateObject<MyApp> ();
+          extraApp->Setup (extraSocket, sinkAddress, 1040, appPackets, DataRate (appRate));
+          extraApp->SetEventRecycling (recycleEvents);
+          if (sendBufferDelay)
+            {
+              extraApp->EnableSendTimeTags ();
+            }
+          if (packetSizes != "fixed")
+            {
+              extraApp->SetPacketSizeDistribution (ParseSizeDistribution (packetSizes, 1040));
+            }
+          extra = extraApp;
+        }
+      term_0.Get (0)->AddApplication (extra);
+      extra->SetStartTime (Seconds (0.));
+      extra->SetStopTime (Seconds (simTime));
+    }
 
   AsciiTraceHelper asciiTraceHelper;
   Ptr<OutputStreamWrapper> stream = asciiTraceHelper.CreateFileStream ("sixth.cwnd");
-  ns3TcpSocket->TraceConnectWithoutContext ("CongestionWindow", MakeBoundCallback (&CwndChange, stream));
+  Ptr<CwndTraceWriter> cwndWriter;
+  if (cwndBinary)
+    {
+      cwndWriter = Create<CwndTraceWriter> (asciiTraceHelper.CreateFileStream ("sixth.cwnd.bin", std::ios::out | std::ios::binary), true);
+      ns3TcpSocket->TraceConnectWithoutContext ("CongestionWindow", MakeBoundCallback (&CwndChangeNs, cwndWriter));
+    }
+  else if (cwndTimeNs)
+    {
+      cwndWriter = Create<CwndTraceWriter> (stream);
+      ns3TcpSocket->TraceConnectWithoutContext ("CongestionWindow", MakeBoundCallback (&CwndChangeNs, cwndWriter));
+    }
+  else
+    {
+      ns3TcpSocket->TraceConnectWithoutContext ("CongestionWindow", MakeBoundCallback (&CwndChange, stream));
+    }
+
+  Ptr<QueueSampler> queueSampler;
+  if (ecnQueue)
+    {
+      queueSampler = Create<QueueSampler> (ecnQueue, asciiTraceHelper.CreateFileStream ("sixth.queue"), MilliSeconds (1));
+      queueSampler->Start ();
+    }
+  if (tcp == "Dctcp")
+    {
+      PointerValue congestionOps;
+      ns3TcpSocket->GetAttribute ("CongestionOps", congestionOps);
+      congestionOps.Get<TcpCongestionOps> ()->TraceConnectWithoutContext ("CongestionEstimate",
+        MakeBoundCallback (&DctcpEstimate, asciiTraceHelper.CreateFileStream ("sixth.alpha")));
+    }
 
   PcapHelper pcapHelper;
-  Ptr<PcapFileWrapper> file = pcapHelper.CreateFile ("sixth.pcap", std::ios::out, PcapHelper::DLT_PPP);
-  ndc_hub_3.Get (1)->TraceConnectWithoutContext ("PhyRxDrop", MakeBoundCallback (&RxDrop, file));
+  Ptr<DropCounter> dropCounter;
+  if (drops == "pcap")
+    {
+      Ptr<PcapFileWrapper> file = pcapHelper.CreateFile ("sixth.pcap", std::ios::out, PcapHelper::DLT_PPP);
+      ndc_hub_3.Get (1)->TraceConnectWithoutContext ("PhyRxDrop", MakeBoundCallback (&RxDrop, file));
+    }
+  else
+    {
+      /* Column 2i + end is end 0 or 1 of link i, as in --captureDevices;
+         receive (PhyRxDrop), root queue disc and device queue (MacTxDrop)
+         drops all count. */
+      std::vector<std::string> labels;
+      for (uint32_t i = 0; i < nLinks; ++i)
+        {
+          labels.push_back ("l" + std::to_string (i) + ".0");
+          labels.push_back ("l" + std::to_string (i) + ".1");
+        }
+      dropCounter = Create<DropCounter> (labels, Time (dropBin), Seconds (simTime));
+      for (uint32_t i = 0; i < nLinks; ++i)
+        {
+          for (uint32_t end = 0; end < 2; ++end)
+            {
+              links[i].Get (end)->TraceConnectWithoutContext ("PhyRxDrop", MakeBoundCallback (&CountDrop, dropCounter, 2 * i + end));
+              links[i].Get (end)->TraceConnectWithoutContext ("MacTxDrop", MakeBoundCallback (&CountDrop, dropCounter, 2 * i + end));
+              ConnectQueueDiscDrops (links[i].Get (end), MakeBoundCallback (&CountQueueDiscDrop, dropCounter, 2 * i + end));
+            }
+        }
+    }
+
+  Ptr<ReorderProbe> reorderProbe;
+  std::vector<uint64_t> pathPackets (pathFirstLink.size ());
+  if (paths > 1)
+    {
+      reorderProbe = Create<ReorderProbe> ();
+      links.front ().Get (0)->TraceConnectWithoutContext ("Sniffer", MakeCallback (&ReorderProbe::SenderSniffer, reorderProbe));
+      links.back ().Get (1)->TraceConnectWithoutContext ("Sniffer", MakeCallback (&ReorderProbe::ReceiverSniffer, reorderProbe));
+      for (uint32_t k = 0; k < paths; ++k)
+        {
+          links[pathFirstLink[k]].Get (0)->TraceConnectWithoutContext ("PhyTxEnd", MakeBoundCallback (&CountPacket, &pathPackets[k]));
+        }
+    }
+
+  Ptr<SendBufferProbe> sendBufferProbe;
+  if (sendBufferDelay)
+    {
+      sendBufferProbe = Create<SendBufferProbe> ();
+      ndc_hub_3.Get (0)->TraceConnectWithoutContext ("PhyTxBegin", MakeCallback (&SendBufferProbe::Transmit, sendBufferProbe));
+    }
+
+  Ptr<LimitClassifier> limitClassifier;
+  if (!limits.empty ())
+    {
+      NS_ABORT_MSG_IF (workload != "bulk", "--limits classifies the first bulk flow; use --workload=bulk");
+      // End 0 of each link transmits away from term_0, on every path.
+      std::vector<Ptr<NetDevice> > forward;
+      for (uint32_t i = 0; i < nLinks; ++i)
+        {
+          forward.push_back (links[i].Get (0));
+        }
+      limitClassifier = Create<LimitClassifier> (ns3TcpSocket, forward, Time (limits), limitsLinkBusy,
+                                                 asciiTraceHelper.CreateFileStream ("sixth.limits"));
+      limitClassifier->Start ();
+    }
+
+  Ptr<SoakMonitor> soakMonitor;
+  if (!soak.empty ())
+    {
+      std::vector<Ptr<NetDevice> > devices;
+      for (uint32_t i = 0; i < nLinks; ++i)
+        {
+          devices.push_back (links[i].Get (0));
+          devices.push_back (links[i].Get (1));
+        }
+      soakMonitor = Create<SoakMonitor> (Time (soak), Seconds (simTime * soakWarmup),
+                                         asciiTraceHelper.CreateFileStream ("sixth.soak"));
+      soakMonitor->AddComponent ("rssKiB", MakeCallback (&SampleRss));
+      soakMonitor->AddComponent ("pendingEvents", MakeCallback (&SamplePendingEvents));
+#ifndef TCPCHAIN_SYSTEM_ALLOC
+      soakMonitor->AddComponent ("liveAllocsProxy", MakeCallback (&SampleLiveAllocations));
+#endif
+      soakMonitor->AddComponent ("queuedPackets", MakeBoundCallback (&SampleQueuedPackets, devices));
+      soakMonitor->AddComponent ("qdiscPackets", MakeBoundCallback (&SampleQueueDiscPackets, devices));
+      soakMonitor->AddComponent ("sendBufferBytes", MakeBoundCallback (&SampleSendBuffers, bulkSockets));
+      soakMonitor->AddComponent ("receiveBufferBytes",
+                                 MakeBoundCallback (&SampleReceiveBuffers, DynamicCast<PacketSink> (sinkApp_tcp_0.Get (0))));
+      soakMonitor->Start ();
+    }
+
+  Ptr<HopLatencyProbe> hopProbe;
+  if (hopSample > 0)
+    {
+      hopProbe = Create<HopLatencyProbe> (hopSample);
+      for (uint32_t i = 0; i < nLinks; ++i)
+        {
+          for (uint32_t end = 0; end < 2; ++end)
+            {
+              Ptr<NetDevice> device = links[i].Get (end);
+              uint32_t node = end ? linkEnds[i].second : linkEnds[i].first;
+              if (node == chain.GetN () - 1)
+                {
+                  device->TraceConnectWithoutContext ("MacRx", MakeCallback (&HopLatencyProbe::Deliver, hopProbe));
+                  continue;
+                }
+              if (node == 0)
+                {
+                  device->TraceConnectWithoutContext ("MacTx", MakeCallback (&HopLatencyProbe::Stamp, hopProbe));
+                }
+              else
+                {
+                  device->TraceConnectWithoutContext ("PhyRxEnd", MakeCallback (&HopLatencyProbe::Arrive, hopProbe));
+                }
+              device->TraceConnectWithoutContext ("PhyTxBegin",
+                                                  MakeBoundCallback (&HopLatencyProbe::Depart, PeekPointer (hopProbe), PeekPointer (device)));
+            }
+        }
+    }
+
+  std::vector<Ptr<FilteredCapture> > captures;
+  if (!capture.empty ())
+    {
+      NetDeviceContainer chainDevices;
+      for (uint32_t i = 0; i < links.size (); ++i)
+        {
+          chainDevices.Add (links[i]);
+        }
+      CaptureFilter filter = CaptureFilter::Compile (capture);
+      std::istringstream devices (captureDevices);
+      std::string index;
+      while (std::getline (devices, index, ','))
+        {
+          uint32_t i = std::stoul (index);
+          NS_ABORT_MSG_IF (i >= chainDevices.GetN (), "No chain device " << i);
+          Ptr<PcapFileWrapper> captureFile = pcapHelper.CreateFile ("sixth-filter-" + index + ".pcap", std::ios::out, PcapHelper::DLT_PPP);
+          Ptr<FilteredCapture> filtered = Create<FilteredCapture> (filter, captureFile);
+          chainDevices.Get (i)->TraceConnectWithoutContext ("Sniffer", MakeCallback (&FilteredCapture::Capture, filtered));
+          captures.push_back (filtered);
+        }
+    }
 
   //OnOffHelper clientHelper_tcp_0 ("ns3::TcpSocketFactory", Address ());
   //clientHelper_tcp_0.SetAttribute ("OnTime", RandomVariableValue (ConstantVariable (1)));
@@ -309,13 +6417,182 @@ main (int argc, char *argv[])
 
   
 
-  Simulator::Stop (Seconds (20));
-  AnimationInterface anim ("animation.xml"); 
-  anim.SetConstantPosition(term_0.Get(0), 1.0, 2.0);
-  anim.SetConstantPosition(term_1.Get(0), 11.0, 2.0);
-  anim.SetConstantPosition(term_2.Get(0), 21.0, 2.0);
-  anim.SetConstantPosition(term_3.Get(0), 31.0, 2.0);
+  Ptr<WarmStartBrancher> brancher;
+  if (!branchAt.empty ())
+    {
+      std::string::size_type colon = branch.find (':');
+      NS_ABORT_MSG_IF (colon == std::string::npos, "--branchAt needs --branch=<param>:<value>,<value>...");
+      std::string param = branch.substr (0, colon);
+      std::vector<std::string> values;
+      std::istringstream list (branch.substr (colon + 1));
+      std::string value;
+      while (std::getline (list, value, ','))
+        {
+          values.push_back (value);
+        }
+      Callback<void, std::string> apply;
+      if (param == "errorRate")
+        {
+          apply = MakeBoundCallback (&SetErrorRate, em);
+        }
+      else if (param == "linkRate")
+        {
+          // The links built with --linkRate: not the edges, nor a separate bottleneck.
+          std::vector<Ptr<NetDevice> > devices;
+          for (uint32_t i = 0; i < nLinks; ++i)
+            {
+              bool edge = paths > 1 && (i == 0 || i == nLinks - 1);
+              if (!edge && !(static_cast<int32_t> (i) == ecnHop && !bottleneckRate.empty ()))
+                {
+                  devices.push_back (links[i].Get (0));
+                  devices.push_back (links[i].Get (1));
+                }
+            }
+          apply = MakeBoundCallback (&SetDeviceRate, devices);
+        }
+      else if (param == "linkDelay")
+        {
+          std::vector<Ptr<Channel> > channels;
+          for (uint32_t i = 0; i < nLinks; ++i)
+            {
+              channels.push_back (links[i].Get (0)->GetChannel ());
+            }
+          apply = MakeBoundCallback (&SetChannelDelay, channels);
+        }
+      else
+        {
+          NS_FATAL_ERROR ("Unknown --branch parameter " << param);
+        }
+      NS_ABORT_MSG_IF (values.empty (), "--branch lists no values");
+      brancher = Create<WarmStartBrancher> (param, values, apply);
+      Simulator::Schedule (Time (branchAt), &WarmStartBrancher::Fork, brancher);
+    }
+
+  Simulator::Stop (Seconds (simTime));
+  std::unique_ptr<AnimationInterface> animation;
+  if (anim)
+    {
+      animation.reset (new AnimationInterface ("animation.xml"));
+      for (uint32_t i = 0; i < chain.GetN (); ++i)
+        {
+          animation->SetConstantPosition (chain.Get (i), positions[i].first, positions[i].second);
+        }
+    }
+  Ptr<RealtimeLagMonitor> lagMonitor;
+  if (emulate)
+    {
+      lagMonitor = Create<RealtimeLagMonitor> (Time (emuLagInterval), Time (emuLagLimit));
+      Simulator::ScheduleNow (&RealtimeLagMonitor::Start, lagMonitor);
+      emulatedHosts[0]->Launch (emulatedHosts[1]->GetAddress ());
+      emulatedHosts[1]->Launch (emulatedHosts[0]->GetAddress ());
+    }
+  std::chrono::steady_clock::time_point runStart = std::chrono::steady_clock::now ();
   Simulator::Run ();
+  for (Ptr<EmulatedHost> host : emulatedHosts)
+    {
+      host->Stop ();
+    }
+  if (brancher && brancher->IsParent ())
+    {
+      if (dropCounter)
+        {
+          // Drops of the shared prefix; each branch writes its own.
+          dropCounter->Write (*asciiTraceHelper.CreateFileStream ("sixth.drops")->GetStream ());
+        }
+      int status = brancher->PrintReport (std::cout);
+      Simulator::Destroy ();
+      return status;
+    }
+  if (runStats)
+    {
+      double wall = std::chrono::duration<double> (std::chrono::steady_clock::now () - runStart).count ();
+      struct rusage usage;
+      getrusage (RUSAGE_SELF, &usage);
+      std::cout << "run: events=" << Simulator::GetEventCount ()
+                << " wall=" << wall
+                << " eventsPerSec=" << Simulator::GetEventCount () / std::max (wall, 1e-9)
+                << " peakRssKiB=" << usage.ru_maxrss
+                << " goodputMbps=" << DynamicCast<PacketSink> (sinkApp_tcp_0.Get (0))->GetTotalRx () * 8 / simTime / 1e6
+                << std::endl;
+#ifndef TCPCHAIN_SYSTEM_ALLOC
+      PoolReport (std::cout);
+#endif
+    }
+  if (cwndWriter)
+    {
+      cwndWriter->Flush ();
+    }
+  if (rpcClient)
+    {
+      std::cout << "rpc: issued=" << rpcClient->GetIssued ()
+                << " completed=" << rpcClient->GetCompleted ()
+                << " rejected=" << rpcClient->GetRejected () << std::endl;
+      rpcClient->GetCompletionTimes ().PrintSummary (std::cout, "rpc completion time");
+    }
+  if (flowGenerator)
+    {
+      std::cout << "flows: started=" << flowGenerator->GetStarted ()
+                << " completed=" << flowSink->GetCompleted ()
+                << " rejected=" << flowGenerator->GetRejected ()
+                << " senderPool=" << flowGenerator->GetPoolSize ()
+                << " sinkPool=" << flowSink->GetPoolSize () << std::endl;
+      flowSink->PrintReport (std::cout);
+    }
+  if (ecnQueue)
+    {
+      Ptr<PacketSink> sink = DynamicCast<PacketSink> (sinkApp_tcp_0.Get (0));
+      std::cout << "ecn: hop=" << ecnHop << " marks=" << ecnQueue->GetMarks ()
+                << " meanQueue=" << queueSampler->GetMean () << "p"
+                << " goodput=" << sink->GetTotalRx () * 8 / simTime / 1e6 << "Mbps" << std::endl;
+    }
+  if (reorderProbe)
+    {
+      Ptr<PacketSink> sink = DynamicCast<PacketSink> (sinkApp_tcp_0.Get (0));
+      std::cout << "ecmp: paths=" << paths << " mode=" << ecmp
+                << " goodput=" << sink->GetTotalRx () * 8 / simTime / 1e6 << "Mbps"
+                << " pathPackets=";
+      for (uint32_t k = 0; k < paths; ++k)
+        {
+          std::cout << (k ? "/" : "") << pathPackets[k];
+        }
+      std::cout << " retransmitted=" << reorderProbe->GetRetransmitted ()
+                << " late=" << reorderProbe->GetLate ()
+                << " reordered=" << reorderProbe->GetReordered () << std::endl;
+    }
+  if (hopProbe)
+    {
+      hopProbe->PrintReport (std::cout);
+    }
+  if (sendBufferProbe)
+    {
+      sendBufferProbe->PrintReport (std::cout);
+    }
+  if (limitClassifier)
+    {
+      limitClassifier->PrintReport (std::cout);
+    }
+  if (soakMonitor)
+    {
+      soakMonitor->PrintReport (std::cout, soakGrowth);
+    }
+  if (flowTraces)
+    {
+      flowTraces->PrintReport (std::cout);
+    }
+  if (dropCounter)
+    {
+      dropCounter->Write (*asciiTraceHelper.CreateFileStream ("sixth.drops")->GetStream ());
+      std::cout << "drops: total=" << dropCounter->GetTotal () << " (sixth.drops)" << std::endl;
+    }
+  if (lagMonitor)
+    {
+      lagMonitor->PrintReport (std::cout);
+    }
+  for (uint32_t i = 0; i < captures.size (); ++i)
+    {
+      std::cout << "capture " << i << ": seen=" << captures[i]->GetSeen ()
+                << " written=" << captures[i]->GetWritten () << std::endl;
+    }
   Simulator::Destroy ();
 
   return 0;